@@ -1,30 +1,120 @@
+#include <errno.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
 #include <unistd.h>
+#ifdef HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
 #define NOTIFICATIONS_DAEMON "/usr/local/bin/herbe"
 #define BUFFER_SIZE 128
-char* execute_command(const char* cmd) {
-  FILE* pipe = popen(cmd, "r");
-  if (!pipe) {
+#define VOLUME_STEP 5
+// Mixer access goes through a backend so the daemon can run against a fake
+// mixer on machines without sound hardware (`audio -d -b fake`).
+typedef struct {
+  const char* name;
+  int (*open)(void);
+  void (*refresh)(void);  // pick up changes made by other programs
+  int (*get_volume)(void);  // percent
+  void (*set_volume)(int percent);
+  int (*get_switch)(int capture);  // 1 = playing / capturing
+  void (*set_switch)(int capture, int on);
+} mixer_backend;
+#ifdef HAVE_ALSA
+static snd_mixer_t* mixer;
+static snd_mixer_elem_t* master;
+static snd_mixer_elem_t* capture;
+static snd_mixer_elem_t* alsa_find(const char* name) {
+  snd_mixer_selem_id_t* sid;
+  snd_mixer_selem_id_alloca(&sid);
+  snd_mixer_selem_id_set_index(sid, 0);
+  snd_mixer_selem_id_set_name(sid, name);
+  return snd_mixer_find_selem(mixer, sid);
+}
+int alsa_open() {
+  if (snd_mixer_open(&mixer, 0) < 0) {
+    return -1;
+  }
+  if (snd_mixer_attach(mixer, "default") < 0 || snd_mixer_selem_register(mixer, NULL, NULL) < 0 ||
+      snd_mixer_load(mixer) < 0) {
+    snd_mixer_close(mixer);
+    return -1;
+  }
+  master = alsa_find("Master");
+  capture = alsa_find("Capture");
+  return master ? 0 : -1;
+}
+void alsa_refresh() { snd_mixer_handle_events(mixer); }
+int alsa_get_volume() {
+  long min, max, vol;
+  snd_mixer_selem_get_playback_volume_range(master, &min, &max);
+  snd_mixer_selem_get_playback_volume(master, SND_MIXER_SCHN_FRONT_LEFT, &vol);
+  return max > min ? (int)(((vol - min) * 100 + (max - min) / 2) / (max - min)) : 0;
+}
+void alsa_set_volume(int percent) {
+  long min, max;
+  snd_mixer_selem_get_playback_volume_range(master, &min, &max);
+  snd_mixer_selem_set_playback_volume_all(master, min + ((max - min) * percent + 50) / 100);
+}
+int alsa_get_switch(int is_capture) {
+  int on = 0;
+  if (is_capture) {
+    if (capture) snd_mixer_selem_get_capture_switch(capture, SND_MIXER_SCHN_FRONT_LEFT, &on);
+  } else {
+    snd_mixer_selem_get_playback_switch(master, SND_MIXER_SCHN_FRONT_LEFT, &on);
+  }
+  return on;
+}
+void alsa_set_switch(int is_capture, int on) {
+  if (is_capture) {
+    if (capture) snd_mixer_selem_set_capture_switch_all(capture, on);
+  } else {
+    snd_mixer_selem_set_playback_switch_all(master, on);
+  }
+}
+#endif
+// In-memory mixer. Every change is logged to stderr, so a test can count
+// how many mixer writes a burst of key presses turned into.
+static int fake_volume = 50;
+static int fake_switch[2] = {1, 1};
+int fake_open() { return 0; }
+void fake_refresh() {}
+int fake_get_volume() { return fake_volume; }
+void fake_set_volume(int percent) {
+  fake_volume = percent;
+  fprintf(stderr, "fake: volume %d\n", percent);
+}
+int fake_get_switch(int is_capture) { return fake_switch[is_capture]; }
+void fake_set_switch(int is_capture, int on) {
+  fake_switch[is_capture] = on;
+  fprintf(stderr, "fake: %s %s\n", is_capture ? "capture" : "playback", on ? "on" : "off");
+}
+static const mixer_backend backends[] = {
+#ifdef HAVE_ALSA
+    {"alsa", alsa_open, alsa_refresh, alsa_get_volume, alsa_set_volume, alsa_get_switch,
+     alsa_set_switch},
+#endif
+    {"fake", fake_open, fake_refresh, fake_get_volume, fake_set_volume, fake_get_switch,
+     fake_set_switch},
+};
+// Without ALSA there is no default: the fake mixer only changes numbers in
+// memory, so it has to be asked for by name.
+const mixer_backend* find_backend(const char* name) {
+  if (!name) {
+#ifdef HAVE_ALSA
+    return &backends[0];
+#else
     return NULL;
+#endif
   }
-  static char buffer[BUFFER_SIZE];
-  if (fgets(buffer, BUFFER_SIZE, pipe) != NULL) {
-    pclose(pipe);
-    size_t len = strlen(buffer);
-    if (len > 0 && buffer[len - 1] == '\n') {
-      buffer[len - 1] = '\0';
+  for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+    if (strcmp(backends[i].name, name) == 0) {
+      return &backends[i];
     }
-    return buffer;
   }
-
-  pclose(pipe);
   return NULL;
 }
-void execute_command_no_output(const char* cmd) { system(cmd); }
 void kill_notification_daemon() {
   char cmd[BUFFER_SIZE];
   snprintf(cmd, BUFFER_SIZE, "pkill -x %s", basename((char*)NOTIFICATIONS_DAEMON));
@@ -38,67 +128,119 @@ void show_notification(const char* message) {
   sleep(1);
   kill_notification_daemon();
 }
-char* get_volume() {
-  static char volume[BUFFER_SIZE];
-  char* result = execute_command("amixer get Master | awk -F'[][]' '/%/ { print $2; exit }'");
-  if (result) {
-    strncpy(volume, result, BUFFER_SIZE);
-    return volume;
+// Applies a batch of commands ('+', '-', 'a'udio toggle, 'm'ic toggle) as at
+// most one volume change and one change per switch, and writes one status
+// line per thing that changed into reply. Returns the reply length.
+size_t apply_commands(const mixer_backend* b, const char* cmds, size_t n, char* reply) {
+  int steps = 0, aud = 0, mic = 0;
+  size_t len = 0;
+  for (size_t i = 0; i < n; i++) {
+    switch (cmds[i]) {
+      case '+': steps++; break;
+      case '-': steps--; break;
+      case 'a': aud ^= 1; break;
+      case 'm': mic ^= 1; break;
+      default: break;
+    }
   }
-  return NULL;
-}
-void control_volume(const char* direction) {
-  if (strcmp(direction, "+") == 0) {
-    execute_command_no_output("amixer set Master 5%+ > /dev/null");
-  } else if (strcmp(direction, "-") == 0) {
-    execute_command_no_output("amixer set Master 5%- > /dev/null");
-  } else {
-    fprintf(stderr, "Invalid volume control direction\n");
-    return;
+  b->refresh();
+  if (steps) {
+    int old = b->get_volume();
+    int vol = old + steps * VOLUME_STEP;
+    vol = vol < 0 ? 0 : vol > 100 ? 100 : vol;
+    if (vol != old) {
+      b->set_volume(vol);
+      if (vol == 100) {
+        len += snprintf(reply + len, BUFFER_SIZE - len, "vol max\n");
+      } else if (vol == 0) {
+        len += snprintf(reply + len, BUFFER_SIZE - len, "vol zero\n");
+      } else {
+        len += snprintf(reply + len, BUFFER_SIZE - len, "vol %d%%\n", vol);
+      }
+    }
   }
-  char* new_vol = get_volume();
-  if (new_vol) {
-    char msg[BUFFER_SIZE];
-    snprintf(msg, BUFFER_SIZE, "vol %s", new_vol);
-    show_notification(msg);
+  if (aud) {
+    int on = !b->get_switch(0);
+    b->set_switch(0, on);
+    len += snprintf(reply + len, BUFFER_SIZE - len, "aud %s\n", on ? "on" : "off");
   }
-}
-void toggle_audio() {
-  int status = atoi(execute_command("amixer get Master | grep '\\[off\\]' -c"));
-  if (status == 0) {
-    execute_command_no_output("amixer set Master mute");
-    show_notification("aud off");
-  } else {
-    execute_command_no_output("amixer set Master unmute");
-    show_notification("aud on");
+  if (mic) {
+    int on = !b->get_switch(1);
+    b->set_switch(1, on);
+    len += snprintf(reply + len, BUFFER_SIZE - len, "mic %s\n", on ? "on" : "off");
   }
+  return len;
 }
-void toggle_mic() {
-  int status = atoi(execute_command("amixer get Capture | grep '\\[off\\]' -c"));
-  if (status == 0) {
-    execute_command_no_output("amixer set Capture nocap");
-    show_notification("mic off");
-  } else {
-    execute_command_no_output("amixer set Capture cap");
-    show_notification("mic on");
+// Daemon mode: mwm writes command bytes to stdin and reads status lines from
+// stdout. Everything queued since the last read is applied as one batch, so a
+// held key turns into one mixer write per round instead of one per repeat.
+int run_daemon(const mixer_backend* b) {
+  char cmds[64];
+  char reply[BUFFER_SIZE];
+  for (;;) {
+    ssize_t n = read(STDIN_FILENO, cmds, sizeof(cmds));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return 0;  // mwm exited or restarted
+    }
+    size_t len = apply_commands(b, cmds, n, reply);
+    if (len && write(STDOUT_FILENO, reply, len) < 0 && errno == EPIPE) {
+      return 0;
+    }
   }
 }
+int usage(const char* name) {
+  fprintf(stderr, "Usage: %s {+ | - | aud | mic} | -d [-b backend]\n", name);
+  return 1;
+}
 int main(int argc, char* argv[]) {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: %s {+ | - | aud | mic}\n", argv[0]);
+  const char* backend_name = getenv("AUDIO_BACKEND");
+  int daemon = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "db:")) != -1) {
+    switch (opt) {
+      case 'd': daemon = 1; break;
+      case 'b': backend_name = optarg; break;
+      default: return usage(argv[0]);
+    }
+  }
+  const mixer_backend* b = find_backend(backend_name);
+  if (!b && !backend_name) {
+    fprintf(stderr, "%s: built without ALSA, use -b fake\n", argv[0]);
     return 1;
   }
-  if (strcmp(argv[1], "+") == 0) {
-    control_volume("+");
-  } else if (strcmp(argv[1], "-") == 0) {
-    control_volume("-");
-  } else if (strcmp(argv[1], "aud") == 0) {
-    toggle_audio();
-  } else if (strcmp(argv[1], "mic") == 0) {
-    toggle_mic();
-  } else {
-    fprintf(stderr, "Usage: %s {+ | - | aud | mic}\n", argv[0]);
+  if (!b) {
+    fprintf(stderr, "%s: unknown backend %s\n", argv[0], backend_name);
     return 1;
   }
+  if (b->open() < 0) {
+    fprintf(stderr, "%s: cannot open %s mixer\n", argv[0], b->name);
+    return 1;
+  }
+  if (daemon) {
+    return optind == argc ? run_daemon(b) : usage(argv[0]);
+  }
+  if (optind + 1 != argc) {
+    return usage(argv[0]);
+  }
+  const char* arg = argv[optind];
+  char cmd;
+  if (strcmp(arg, "+") == 0 || strcmp(arg, "-") == 0) {
+    cmd = arg[0];
+  } else if (strcmp(arg, "aud") == 0) {
+    cmd = 'a';
+  } else if (strcmp(arg, "mic") == 0) {
+    cmd = 'm';
+  } else {
+    return usage(argv[0]);
+  }
+  char reply[BUFFER_SIZE];
+  size_t len = apply_commands(b, &cmd, 1, reply);
+  if (len) {
+    reply[len - 1] = '\0';
+    show_notification(reply);
+  }
   return 0;
 }
@@ -0,0 +1,386 @@
+// Test client for `make bench`: drives a running mwm with XTest key presses
+// and real windows, and counts the requests mwm sends with the RECORD
+// extension. bench/run.sh starts Xvfb and mwm and then this program.
+//
+//   bench/bench [-n windows] [-r rounds]
+//
+// For every operation it prints latency percentiles (request to the event
+// that shows mwm has finished) and the X requests mwm issued per operation.
+// After desktop switches it also checks that windows on the hidden desktop
+// carry IconicState and _NET_WM_STATE_HIDDEN, and visible ones do not.
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XTest.h>
+#include <X11/extensions/record.h>
+#include <X11/keysym.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+#define DEFAULT_WINDOWS 16
+#define DEFAULT_ROUNDS 50
+#define MAX_WINDOWS 256
+#define WAIT_TIMEOUT_US 2000000.0
+// quiet period before reading request counters or starting the next step
+#define SETTLE_US 5000
+
+typedef struct {
+        const char *name;
+        double *samples;
+        int count;
+        unsigned long requests;
+} Op;
+enum { OpMap, OpFocus, OpSwitch, OpResize, OpClose, OpLast };
+static Op ops[OpLast] = {{"map", NULL, 0, 0},
+                         {"focus", NULL, 0, 0},
+                         {"switch", NULL, 0, 0},
+                         {"resize", NULL, 0, 0},
+                         {"close", NULL, 0, 0}};
+static Display *dpy, *recordCtl, *recordData;
+static Window root;
+static XID mwmBase, resourceMask;
+static unsigned long mwmRequests = 0;
+static Window focused = None;
+static KeyCode modKey, shiftKey;
+static Atom wmStateAtom, netWMState, netWMStateHidden;
+// windows opened on desktop 1 and desktop 2
+static Window desk[2][MAX_WINDOWS];
+static int deskCount[2];
+
+static double nowUs(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+static void fail(const char *what) {
+        fprintf(stderr, "bench: %s\n", what);
+        exit(1);
+}
+// real focus changes, not the grab/ungrab pairs around mwm's key grabs
+static int isFocusIn(XEvent *e) {
+        return e->type == FocusIn && e->xfocus.mode != NotifyGrab &&
+               e->xfocus.mode != NotifyUngrab;
+}
+static void onRecord(XPointer closure, XRecordInterceptData *d) {
+        (void)closure;
+        if (d->category == XRecordFromClient && (d->id_base & ~resourceMask) == mwmBase)
+                mwmRequests++;
+        XRecordFreeData(d);
+}
+// Waits until match() accepts an event. Every FocusIn updates `focused`
+// first. The RECORD connection is drained meanwhile so the server never
+// blocks on it.
+typedef int (*EventMatch)(XEvent *, void *);
+static int waitEvent(EventMatch match, void *arg) {
+        double deadline = nowUs() + WAIT_TIMEOUT_US;
+        int xfd = ConnectionNumber(dpy), rfd = ConnectionNumber(recordData);
+        XEvent e;
+        for (;;) {
+                while (XPending(dpy)) {
+                        XNextEvent(dpy, &e);
+                        if (isFocusIn(&e)) focused = e.xfocus.window;
+                        if (match(&e, arg)) return 1;
+                }
+                double left = deadline - nowUs();
+                if (left <= 0) return 0;
+                fd_set fds;
+                FD_ZERO(&fds);
+                FD_SET(xfd, &fds);
+                FD_SET(rfd, &fds);
+                struct timeval tv = {(long)(left / 1e6), (long)left % 1000000};
+                select((xfd > rfd ? xfd : rfd) + 1, &fds, NULL, NULL, &tv);
+                XRecordProcessReplies(recordData);
+        }
+}
+// Lets mwm finish, throws away stale events and returns the request count.
+static unsigned long settle(void) {
+        usleep(SETTLE_US);
+        XSync(dpy, False);
+        XEvent e;
+        while (XPending(dpy)) {
+                XNextEvent(dpy, &e);
+                if (isFocusIn(&e)) focused = e.xfocus.window;
+        }
+        XRecordProcessReplies(recordData);
+        return mwmRequests;
+}
+static void sample(Op *op, double t0) {
+        op->samples[op->count++] = nowUs() - t0;
+}
+static void pressKey(KeySym sym, int shift) {
+        KeyCode key = XKeysymToKeycode(dpy, sym);
+        XTestFakeKeyEvent(dpy, modKey, True, CurrentTime);
+        if (shift) XTestFakeKeyEvent(dpy, shiftKey, True, CurrentTime);
+        XTestFakeKeyEvent(dpy, key, True, CurrentTime);
+        XTestFakeKeyEvent(dpy, key, False, CurrentTime);
+        if (shift) XTestFakeKeyEvent(dpy, shiftKey, False, CurrentTime);
+        XTestFakeKeyEvent(dpy, modKey, False, CurrentTime);
+        XFlush(dpy);
+}
+
+typedef struct {
+        Window win;
+        int mapped, configured;
+} MapState;
+static int matchTiled(XEvent *e, void *arg) {
+        MapState *s = arg;
+        if (e->type == MapNotify && e->xmap.window == s->win) s->mapped = 1;
+        if (e->type == ConfigureNotify && e->xconfigure.window == s->win) s->configured = 1;
+        return s->mapped && s->configured;
+}
+// map-to-tiled: XMapWindow until the window is both mapped and configured
+static void openWindow(int d) {
+        Window w = XCreateSimpleWindow(dpy, root, 0, 0, 100, 100, 0, 0, 0);
+        XSelectInput(dpy, w, StructureNotifyMask | FocusChangeMask);
+        unsigned long r0 = settle();
+        MapState s      = {w, 0, 0};
+        double t0       = nowUs();
+        XMapWindow(dpy, w);
+        XFlush(dpy);
+        if (!waitEvent(matchTiled, &s)) fail("window was not tiled");
+        sample(&ops[OpMap], t0);
+        ops[OpMap].requests += settle() - r0;
+        desk[d][deskCount[d]++] = w;
+}
+static int matchFocusChange(XEvent *e, void *arg) {
+        return isFocusIn(e) && e->xfocus.window != *(Window *)arg;
+}
+static void cycleFocus(void) {
+        Window before    = focused;
+        unsigned long r0 = settle();
+        double t0        = nowUs();
+        pressKey(XK_j, 0);
+        if (!waitEvent(matchFocusChange, &before)) fail("focus did not move");
+        sample(&ops[OpFocus], t0);
+        ops[OpFocus].requests += settle() - r0;
+}
+static int matchFocusOn(XEvent *e, void *arg) {
+        int d = *(int *)arg;
+        if (!isFocusIn(e)) return 0;
+        for (int i = 0; i < deskCount[d]; i++) {
+                if (desk[d][i] == e->xfocus.window) return 1;
+        }
+        return 0;
+}
+// mwm focuses the new desktop's window right after mapping its container
+static void switchTo(int d, int measure) {
+        if (!deskCount[d]) {
+                // nothing will take focus; just give mwm time to switch
+                pressKey(XK_1 + d, 0);
+                settle();
+                return;
+        }
+        unsigned long r0 = settle();
+        double t0        = nowUs();
+        pressKey(XK_1 + d, 0);
+        if (!waitEvent(matchFocusOn, &d)) fail("desktop switch did not focus a window");
+        if (!measure) return;
+        sample(&ops[OpSwitch], t0);
+        ops[OpSwitch].requests += settle() - r0;
+}
+typedef struct {
+        Window win;
+        int width;
+} WidthState;
+static int matchWidthChange(XEvent *e, void *arg) {
+        WidthState *s = arg;
+        return e->type == ConfigureNotify && e->xconfigure.window == s->win &&
+               e->xconfigure.width != s->width;
+}
+static void resize(int grow) {
+        XWindowAttributes attr;
+        XGetWindowAttributes(dpy, desk[1][0], &attr);
+        WidthState s     = {desk[1][0], attr.width};
+        unsigned long r0 = settle();
+        double t0        = nowUs();
+        pressKey(grow ? XK_l : XK_h, 1);
+        if (!waitEvent(matchWidthChange, &s)) fail("master was not resized");
+        sample(&ops[OpResize], t0);
+        ops[OpResize].requests += settle() - r0;
+}
+typedef struct {
+        Window *wins;
+        int count;
+} Retile;
+static int matchRetile(XEvent *e, void *arg) {
+        Retile *s = arg;
+        if (e->type != ConfigureNotify) return 0;
+        for (int i = 0; i < s->count; i++) {
+                if (s->wins[i] == e->xconfigure.window) return 1;
+        }
+        return 0;
+}
+// destroy-to-retile: until one of the remaining windows is reconfigured
+static void closeWindows(int d) {
+        while (deskCount[d] > 1) {
+                Window w         = desk[d][--deskCount[d]];
+                Retile s         = {desk[d], deskCount[d]};
+                unsigned long r0 = settle();
+                double t0        = nowUs();
+                XDestroyWindow(dpy, w);
+                XFlush(dpy);
+                if (!waitEvent(matchRetile, &s)) fail("closing did not retile");
+                sample(&ops[OpClose], t0);
+                ops[OpClose].requests += settle() - r0;
+        }
+        XDestroyWindow(dpy, desk[d][0]);
+        deskCount[d] = 0;
+}
+static long windowState(Window w) {
+        Atom type;
+        int format;
+        unsigned long count, after;
+        unsigned char *data = NULL;
+        long state          = -1;
+        if (XGetWindowProperty(dpy, w, wmStateAtom, 0, 2, False, wmStateAtom, &type, &format,
+                               &count, &after, &data) == Success &&
+            data && format == 32 && count >= 1)
+                state = *(long *)data;
+        if (data) XFree(data);
+        return state;
+}
+static int isHidden(Window w) {
+        Atom type;
+        int format, hidden = 0;
+        unsigned long count, after;
+        unsigned char *data = NULL;
+        if (XGetWindowProperty(dpy, w, netWMState, 0, 32, False, XA_ATOM, &type, &format, &count,
+                               &after, &data) == Success &&
+            data && format == 32) {
+                for (unsigned long i = 0; i < count; i++)
+                        hidden |= ((Atom *)data)[i] == netWMStateHidden;
+        }
+        if (data) XFree(data);
+        return hidden;
+}
+static void checkStates(int visible) {
+        settle();
+        for (int d = 0; d < 2; d++) {
+                for (int i = 0; i < deskCount[d]; i++) {
+                        long state = windowState(desk[d][i]);
+                        int hidden = isHidden(desk[d][i]);
+                        if (d == visible && (state != NormalState || hidden))
+                                fail("window on the current desktop is not in NormalState");
+                        if (d != visible && (state != IconicState || !hidden))
+                                fail("window on a hidden desktop is not marked hidden");
+                }
+        }
+}
+static int cmpDouble(const void *a, const void *b) {
+        double x = *(const double *)a, y = *(const double *)b;
+        return (x > y) - (x < y);
+}
+static void report(void) {
+        printf("%-8s %6s %10s %10s %10s %8s\n", "op", "n", "p50", "p90", "p99", "req/op");
+        for (int i = 0; i < OpLast; i++) {
+                Op *op = &ops[i];
+                if (!op->count) continue;
+                qsort(op->samples, op->count, sizeof(double), cmpDouble);
+                printf("%-8s %6d %8.1fus %8.1fus %8.1fus %8.1f\n", op->name, op->count,
+                       op->samples[op->count / 2], op->samples[op->count * 90 / 100],
+                       op->samples[op->count * 99 / 100], (double)op->requests / op->count);
+        }
+}
+// mwm's containers are the only children of the root when the bench starts;
+// their resource base identifies mwm's requests in the RECORD stream.
+static void findMwm(void) {
+        double deadline = nowUs() + WAIT_TIMEOUT_US;
+        Window r, p, *children = NULL;
+        unsigned int n = 0;
+        while (nowUs() < deadline) {
+                if (XQueryTree(dpy, root, &r, &p, &children, &n) && n > 0) {
+                        mwmBase = children[0] & ~resourceMask;
+                        XFree(children);
+                        return;
+                }
+                usleep(10000);
+        }
+        fail("mwm is not running");
+}
+static void startRecord(void) {
+        int major, minor;
+        recordCtl  = XOpenDisplay(NULL);
+        recordData = XOpenDisplay(NULL);
+        if (!recordCtl || !recordData) fail("cannot open display");
+        if (!XRecordQueryVersion(recordCtl, &major, &minor)) fail("no RECORD extension");
+        // every core and extension request; onRecord() keeps mwm's
+        XRecordRange *range                 = XRecordAllocRange();
+        range->core_requests.first          = 1;
+        range->core_requests.last           = 127;
+        range->ext_requests.ext_major.first = 128;
+        range->ext_requests.ext_major.last  = 255;
+        range->ext_requests.ext_minor.first = 0;
+        range->ext_requests.ext_minor.last  = 65535;
+        XRecordClientSpec clients           = XRecordAllClients;
+        XRecordContext ctx = XRecordCreateContext(recordCtl, 0, &clients, 1, &range, 1);
+        XFree(range);
+        if (!ctx) fail("cannot create RECORD context");
+        XSync(recordCtl, False);
+        if (!XRecordEnableContextAsync(recordData, ctx, onRecord, NULL))
+                fail("cannot enable RECORD context");
+}
+int main(int argc, char *argv[]) {
+        int windows = DEFAULT_WINDOWS, rounds = DEFAULT_ROUNDS, opt;
+        while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+                switch (opt) {
+                        case 'n':
+                                windows = atoi(optarg);
+                                break;
+                        case 'r':
+                                rounds = atoi(optarg);
+                                break;
+                        default:
+                                fprintf(stderr, "usage: %s [-n windows] [-r rounds]\n", argv[0]);
+                                return 1;
+                }
+        }
+        if (windows < 4 || windows > 2 * MAX_WINDOWS) fail("-n must be between 4 and 512");
+        if (rounds < 1) fail("-r must be positive");
+        dpy = XOpenDisplay(NULL);
+        if (!dpy) fail("cannot open display");
+        int event, error, major, minor;
+        if (!XTestQueryExtension(dpy, &event, &error, &major, &minor)) fail("no XTEST extension");
+        // Xlib keeps the resource id mask private; XCB's setup data has it
+        xcb_connection_t *conn = xcb_connect(NULL, NULL);
+        if (xcb_connection_has_error(conn)) fail("cannot open display");
+        resourceMask = xcb_get_setup(conn)->resource_id_mask;
+        xcb_disconnect(conn);
+        root     = DefaultRootWindow(dpy);
+        modKey   = XKeysymToKeycode(dpy, XK_Super_L);
+        shiftKey = XKeysymToKeycode(dpy, XK_Shift_L);
+        if (!modKey || !shiftKey) fail("no Super_L or Shift_L in the keymap");
+        wmStateAtom      = XInternAtom(dpy, "WM_STATE", False);
+        netWMState       = XInternAtom(dpy, "_NET_WM_STATE", False);
+        netWMStateHidden = XInternAtom(dpy, "_NET_WM_STATE_HIDDEN", False);
+        findMwm();
+        startRecord();
+        int perSample = windows > rounds ? windows : rounds;
+        for (int i = 0; i < OpLast; i++) {
+                ops[i].samples = malloc(2 * perSample * sizeof(double));
+                if (!ops[i].samples) fail("out of memory");
+        }
+        // half the windows on desktop 1, half on desktop 2
+        for (int i = 0; i < windows / 2; i++) openWindow(0);
+        switchTo(1, 0);
+        for (int i = windows / 2; i < windows; i++) openWindow(1);
+        for (int i = 0; i < rounds; i++) cycleFocus();
+        for (int i = 0; i < rounds; i++) resize(i & 1 ? 0 : 1);
+        for (int i = 0; i < rounds; i++) {
+                switchTo(0, 1);
+                switchTo(1, 1);
+        }
+        checkStates(1);
+        switchTo(0, 0);
+        checkStates(0);
+        // windows only retile on the current desktop
+        switchTo(1, 0);
+        closeWindows(1);
+        switchTo(0, 0);
+        closeWindows(0);
+        report();
+        return 0;
+}
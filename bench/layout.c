@@ -0,0 +1,74 @@
+// Cost of one layoutApply() per layout and window count, with no X server.
+//
+//   bench/layout [iterations]
+//
+// Before timing, every result is checked: windows stay on screen and, except
+// in monocle, do not overlap. A broken layout makes the benchmark fail.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../layout.h"
+#define DEFAULT_ITERATIONS 200000
+#define SCREEN_W 1920
+#define SCREEN_H 1080
+#define MAX_N 256
+
+static double nowNs(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+static int overlap(const Geometry *a, const Geometry *b) {
+        return a->x < b->x + (int)b->w && b->x < a->x + (int)a->w && a->y < b->y + (int)b->h &&
+               b->y < a->y + (int)a->h;
+}
+static int check(unsigned char layout, unsigned short n, int delta, const Geometry *g) {
+        for (unsigned short i = 0; i < n; i++) {
+                if (g[i].x < 0 || g[i].y < 0 || g[i].w == 0 || g[i].h == 0 ||
+                    g[i].x + g[i].w > SCREEN_W || g[i].y + g[i].h > SCREEN_H) {
+                        fprintf(stderr, "%s n %u delta %d: window %u off screen\n",
+                                layoutNames[layout], n, delta, i);
+                        return 0;
+                }
+                for (unsigned short j = 0; j < i && layout != LayoutMonocle; j++) {
+                        if (overlap(&g[i], &g[j])) {
+                                fprintf(stderr, "%s n %u delta %d: windows %u and %u overlap\n",
+                                        layoutNames[layout], n, delta, j, i);
+                                return 0;
+                        }
+                }
+        }
+        return 1;
+}
+int main(int argc, char *argv[]) {
+        int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+        if (iterations <= 0) iterations = DEFAULT_ITERATIONS;
+        static Geometry out[MAX_N];
+        static const int deltas[] = {-10000, -300, 0, 300, 10000};
+        for (unsigned char l = 0; l < LayoutLast; l++) {
+                for (unsigned short n = 1; n <= MAX_N; n++) {
+                        for (unsigned int d = 0; d < sizeof(deltas) / sizeof(deltas[0]); d++) {
+                                layoutApply(l, n, SCREEN_W, SCREEN_H, deltas[d], out);
+                                if (!check(l, n, deltas[d], out)) return 1;
+                        }
+                }
+        }
+        static const unsigned short counts[] = {1, 2, 4, 16, 64, 256};
+        volatile int sink = 0;
+        for (unsigned char l = 0; l < LayoutLast; l++) {
+                for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+                        double t0 = nowNs();
+                        for (int i = 0; i < iterations; i++) {
+                                layoutApply(l, counts[c], SCREEN_W, SCREEN_H, i & 63, out);
+                                sink += out[counts[c] - 1].x;
+                        }
+                        double ns = (nowNs() - t0) / iterations;
+                        printf("%-8s n %3u %8.1fns/layout %6.2fns/window\n", layoutNames[l],
+                               counts[c], ns, ns / counts[c]);
+                }
+        }
+        (void)sink;
+        return 0;
+}
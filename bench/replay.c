@@ -0,0 +1,1182 @@
+// Feeds an event trace through mwm's own handlers with no X server. Xlib is
+// replaced by stubs that model the window tree, count the requests mwm sends
+// and report the ones a server would reject or that contradict mwm's own
+// bookkeeping; the desktops are checked after every batch.
+//
+//   bench/replay [-q] TRACE                    replay a trace from mwm-trace
+//   bench/replay -g EVENTS [-s SEED] TRACE     write and replay a synthetic one
+//
+// -q skips the per-batch checks, to time the handlers alone. The generator
+// plays the clients, the server, the audio helper and control socket users:
+// it maps, withdraws and destroys windows, presses bound keys, sends control
+// lines, and answers mwm's requests the way they would, e.g. with an
+// UnmapNotify for reparenting a mapped window, the client exiting after
+// WM_DELETE_WINDOW, a sync alarm or a volume reply for the OSD. Replaying what
+// it wrote must give the same request counts.
+//
+// The keymap comes from the trace header, and nowMs() runs on the times in
+// the trace, so timers fire where they did. A trace starts from an empty
+// session: windows that existed when mwm-trace started are not recorded.
+// Built with AUDIO_HELPER, as a default mwm is; fork() is a stub, so the
+// helper never runs.
+#define main mwmMain
+#define clock_gettime replayClock
+#include "../main.c"
+#undef main
+#undef clock_gettime
+// <time.h> declared replayClock() in its place; the timing below is real
+int clock_gettime(clockid_t id, struct timespec *ts);
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+#define ROOT 1
+#define FIRST_ID 0x200000// ids the stub server hands out to mwm
+#define GEN_FIRST_WINDOW 0x400001
+#define GEN_MAX_WINDOWS 64// live client windows in a synthetic trace
+#define GEN_BATCH 6// events per batch, at most
+#define MAX_REPORTS 20
+#define CLOCK_BASE 1000000// nowMs() when the trace starts
+enum {
+        ReqConfigure,
+        ReqMap,
+        ReqUnmap,
+        ReqReparent,
+        ReqFocus,
+        ReqProperty,
+        ReqSendEvent,
+        ReqKill,
+        ReqSelectInput,
+        ReqSaveSet,
+        ReqGrab,
+        ReqAlarm,
+        ReqCreate,
+        ReqOther,
+        ReqRoundTrip,
+        ReqFlush,
+        // not X requests
+        ReqSpawn,
+        ReqAudio,
+        ReqReply,
+        ReqLast
+};
+static const char *const reqNames[ReqLast] = {
+    "configure", "map",    "unmap",  "reparent", "focus",     "property", "sendevent", "kill",
+    "select",    "saveset", "grab",  "alarm",    "create",    "other",    "roundtrip", "flush",
+    "spawn",     "audio",   "reply"};
+typedef struct {
+        Window id, parent;
+        Window top;// child raised or reparented in last
+        int x, y;
+        unsigned int w, h;
+        // UnmapNotify events still due for reparenting it while mapped; the
+        // window itself is mapped again right away
+        unsigned char reparentUnmaps;
+        _Bool alive, mapped;
+        _Bool own;// created by mwm, like the desktop containers
+        unsigned long withdrawnIn;// batch of the last UnmapNotify, counted from 1
+        unsigned char protocols;// PROTO_ flags of its WM_PROTOCOLS
+} MockWindow;
+static struct {
+        MockWindow *windows;
+        unsigned int len, cap;
+        unsigned int *index;// id -> windows[] + 1, open addressing
+        unsigned int mask;
+        Window nextId;
+        Window focus;
+        unsigned int width, height;
+        uint32_t keymap[256];
+        unsigned long long clockMs;
+        unsigned long requests[ReqLast];
+        // events the server owes mwm; only filled while generating
+        _Bool generating;
+        FILE *out;
+        TraceRecord *queue;// payloads follow their record here too
+        unsigned int qhead, qlen, qcap;
+        unsigned int batchLeft;// queued records still due in this batch
+        // while replaying a file, the records after the one being fed
+        const TraceRecord *next, *end;
+        unsigned long records, events, batches, errors;
+} mock = {.nextId = FIRST_ID, .clockMs = CLOCK_BASE};
+// evdev keycodes of a US layout for synthetic traces
+static const uint32_t genKeymap[256] = {
+    [10] = XK_1,  [11] = XK_2,      [12] = XK_3,      [13] = XK_4,      [14] = XK_5,
+    [15] = XK_6,  [16] = XK_7,      [17] = XK_8,      [18] = XK_9,      [24] = XK_q,
+    [27] = XK_r,  [33] = XK_p,      [36] = XK_Return, [43] = XK_h,      [44] = XK_j,
+    [45] = XK_k,  [46] = XK_l,      [65] = XK_space,  [121] = XF86XK_AudioMute,
+    [122] = XF86XK_AudioLowerVolume, [123] = XF86XK_AudioRaiseVolume,
+    [198] = XF86XK_AudioMicMute};
+
+static void fail(const char *fmt, ...) {
+        if (++mock.errors > MAX_REPORTS) return;
+        va_list ap;
+        va_start(ap, fmt);
+        fprintf(stderr, "replay: record %lu: ", mock.records);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+}
+static unsigned long long rng = 0x9E3779B97F4A7C15ull;
+static unsigned int rnd(unsigned int n) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return rng % n;
+}
+// The record after r, past the text of a TraceControl or TraceAudio.
+static const TraceRecord *nextRecord(const TraceRecord *r) {
+        return r + 1 + (r->kind == TraceControl || r->kind == TraceAudio ? TRACE_PAYLOAD(r->a) : 0);
+}
+static unsigned int mockSlot(Window id) {
+        return (unsigned int)((id * 0x9E3779B97F4A7C15ull) >> 32) & mock.mask;
+}
+static MockWindow *mockFind(Window id) {
+        for (unsigned int i = mockSlot(id);; i = (i + 1) & mock.mask) {
+                if (!mock.index[i]) return NULL;
+                MockWindow *m = &mock.windows[mock.index[i] - 1];
+                if (m->id == id) return m;
+        }
+}
+// Windows are never forgotten, so a reused XID just comes back to life.
+static MockWindow *mockAdd(Window id, Window parent) {
+        MockWindow *m = mockFind(id);
+        if (!m) {
+                if ((mock.len + 1) * 2 > mock.mask + 1) {
+                        unsigned int *old = mock.index, oldLen = mock.mask + 1;
+                        mock.mask         = oldLen * 2 - 1;
+                        mock.index        = calloc(oldLen * 2, sizeof(unsigned int));
+                        if (!mock.index) die();
+                        for (unsigned int k = 0; k < oldLen; k++) {
+                                if (!old[k]) continue;
+                                unsigned int i = mockSlot(mock.windows[old[k] - 1].id);
+                                while (mock.index[i]) i = (i + 1) & mock.mask;
+                                mock.index[i] = old[k];
+                        }
+                        free(old);
+                }
+                if (mock.len == mock.cap) {
+                        mock.cap     = mock.cap ? mock.cap * 2 : 256;
+                        mock.windows = realloc(mock.windows, mock.cap * sizeof(MockWindow));
+                        if (!mock.windows) die();
+                }
+                unsigned int i = mockSlot(id);
+                while (mock.index[i]) i = (i + 1) & mock.mask;
+                mock.index[i] = ++mock.len;
+                m             = &mock.windows[mock.len - 1];
+        }
+        *m = (MockWindow){.id = id, .parent = parent, .alive = True, .protocols = PROTO_DELETE};
+        // a replay learns the protocols from the trace
+        if (mock.generating && !rnd(4)) m->protocols |= PROTO_SYNC;
+        return m;
+}
+// Every request names its window; one the server does not know is BadWindow.
+static MockWindow *use(Window id, unsigned char req) {
+        mock.requests[req]++;
+        MockWindow *m = mockFind(id);
+        if (!m || !m->alive) {
+                fail("%s on unknown window 0x%lx\n", reqNames[req], id);
+                return NULL;
+        }
+        return m;
+}
+static _Bool viewable(MockWindow *m) {
+        while (m && m->mapped && m->id != ROOT) m = mockFind(m->parent);
+        return m && m->id == ROOT;
+}
+static void queuePush(unsigned char kind, unsigned char a, unsigned short b, Window win) {
+        if (mock.qlen == mock.qcap) {
+                // unwrap into the front of a bigger ring
+                TraceRecord *grown = malloc((mock.qcap ? mock.qcap * 2 : 16) * sizeof(TraceRecord));
+                if (!grown) die();
+                for (unsigned int i = 0; i < mock.qlen; i++)
+                        grown[i] = mock.queue[(mock.qhead + i) % mock.qcap];
+                free(mock.queue);
+                mock.queue = grown;
+                mock.qhead = 0;
+                mock.qcap  = mock.qcap ? mock.qcap * 2 : 16;
+        }
+        mock.queue[(mock.qhead + mock.qlen++) % mock.qcap] = (TraceRecord){kind, a, b, win};
+}
+static void queueText(unsigned char kind, const char *text, unsigned char len, unsigned short b) {
+        TraceRecord pad[TRACE_PAYLOAD(255)] = {0};
+        memcpy(pad, text, len);
+        queuePush(kind, len, b, 0);
+        for (unsigned int i = 0; i < TRACE_PAYLOAD(len); i++)
+                queuePush(pad[i].kind, pad[i].a, pad[i].b, pad[i].window);
+}
+// Takes the record at the head of the queue and its text into r.
+static void queuePop(TraceRecord *r) {
+        for (unsigned int i = 0, n = 1; i < n; i++) {
+                r[i]       = mock.queue[mock.qhead];
+                mock.qhead = (mock.qhead + 1) % mock.qcap;
+                mock.qlen--;
+                if (!i) n = nextRecord(r) - r;
+        }
+}
+// Records that mwm writes itself while handling one, like the protocols it
+// read, go straight to the synthetic trace.
+static void genWrite(unsigned char kind, unsigned char a, unsigned short b, Window win) {
+        TraceRecord r = {kind, a, b, win};
+        fwrite(&r, sizeof(r), 1, mock.out);
+        mock.records++;
+}
+// The i-th record mwm already has queued behind the one being fed: the rest
+// of the batch, and while generating only what the server owes so far.
+static const TraceRecord *ahead(unsigned int i) {
+        if (mock.generating) {
+                for (unsigned int j = 0, k = 0; j < mock.qlen && k < mock.batchLeft; k++) {
+                        const TraceRecord *r = &mock.queue[(mock.qhead + j) % mock.qcap];
+                        if (k == i) return r;
+                        j += nextRecord(r) - r;
+                }
+                return NULL;
+        }
+        for (const TraceRecord *r = mock.next; r < mock.end; r = nextRecord(r), i--) {
+                if (r->kind == TraceBatchEnd) return NULL;
+                if (!i) return r;
+        }
+        return NULL;
+}
+// The client goes away: an UnmapNotify if it was mapped, then DestroyNotify.
+// The window is gone by the time mwm reads the first of them.
+static void clientExits(MockWindow *m) {
+        if (!mock.generating) return;
+        if (m->mapped) queuePush(TraceUnmapNotify, 0, 0, m->id);
+        queuePush(TraceDestroyNotify, 0, 0, m->id);
+}
+
+Display *XOpenDisplay(_Xconst char *name) {
+        static Screen screen;
+        _XPrivDisplay d = calloc(1, sizeof(*d));
+        (void)name;
+        if (!d) return NULL;
+        // something epoll accepts for the connection
+        d->fd             = eventfd(0, EFD_CLOEXEC);
+        screen.root       = ROOT;
+        screen.width      = mock.width;
+        screen.height     = mock.height;
+        d->screens        = &screen;
+        d->nscreens       = 1;
+        d->default_screen = 0;
+        mock.index        = calloc(INDEX_SIZE, sizeof(unsigned int));
+        mock.mask         = INDEX_SIZE - 1;
+        if (!mock.index) return NULL;
+        mockAdd(ROOT, None)->mapped = True;
+        return (Display *)d;
+}
+int XCloseDisplay(Display *d) {
+        (void)d;
+        return 0;
+}
+XErrorHandler XSetErrorHandler(XErrorHandler handler) {
+        (void)handler;
+        return NULL;
+}
+int XSync(Display *d, Bool discard) {
+        (void)d;
+        (void)discard;
+        mock.requests[ReqRoundTrip]++;
+        return 1;
+}
+int XFlush(Display *d) {
+        (void)d;
+        mock.requests[ReqFlush]++;
+        return 1;
+}
+int XPending(Display *d) {
+        (void)d;
+        return 0;
+}
+// finishBatch() runs after the last record of a batch, with nothing queued.
+int XEventsQueued(Display *d, int mode) {
+        (void)d;
+        (void)mode;
+        return 0;
+}
+int XNextEvent(Display *d, XEvent *e) {
+        (void)d;
+        (void)e;
+        return 0;
+}
+int XFree(void *data) {
+        free(data);
+        return 1;
+}
+Status XInternAtoms(Display *d, char **names, int count, Bool onlyIfExists, Atom *ret) {
+        (void)d;
+        (void)names;
+        (void)onlyIfExists;
+        mock.requests[ReqRoundTrip]++;
+        for (int i = 0; i < count; i++) ret[i] = XA_LAST_PREDEFINED + 1 + i;
+        return 1;
+}
+Status XGetWindowAttributes(Display *d, Window w, XWindowAttributes *attr) {
+        (void)d;
+        MockWindow *m = use(w, ReqRoundTrip);
+        if (!m) return 0;
+        memset(attr, 0, sizeof(*attr));
+        attr->x         = m->x;
+        attr->y         = m->y;
+        attr->width     = w == ROOT ? mock.width : m->w;
+        attr->height    = w == ROOT ? mock.height : m->h;
+        attr->map_state = viewable(m) ? IsViewable : m->mapped ? IsUnviewable : IsUnmapped;
+        return 1;
+}
+// The session starts empty: nothing to adopt or take over.
+Status XQueryTree(Display *d, Window w, Window *rootRet, Window *parent, Window **children,
+                  unsigned int *n) {
+        (void)d;
+        MockWindow *m = use(w, ReqRoundTrip);
+        *rootRet      = ROOT;
+        *parent       = m ? m->parent : None;
+        *children     = NULL;
+        *n            = 0;
+        return m != NULL;
+}
+int XGetWindowProperty(Display *d, Window w, Atom property, long offset, long length,
+                       Bool delete, Atom reqType, Atom *type, int *format, unsigned long *n,
+                       unsigned long *after, unsigned char **data) {
+        (void)d;
+        (void)offset;
+        (void)length;
+        (void)delete;
+        (void)reqType;
+        MockWindow *m = use(w, ReqRoundTrip);
+        if (!m) return BadWindow;
+        *type   = None;
+        *format = 0;
+        *n = *after = 0;
+        *data       = NULL;
+        // clients that take sync requests name their counter; nothing else is set
+        if (property != atoms[NetWMSyncRequestCounter] || !(m->protocols & PROTO_SYNC))
+                return Success;
+        unsigned long *counter = malloc(sizeof(*counter));
+        if (!counter) return BadAlloc;
+        *counter = w;
+        *type    = XA_CARDINAL;
+        *format  = 32;
+        *n       = 1;
+        *data    = (unsigned char *)counter;
+        return Success;
+}
+// mwm-trace writes what it read right after the event that made it look.
+Status XGetWMProtocols(Display *d, Window w, Atom **protocols, int *count) {
+        (void)d;
+        MockWindow *m = use(w, ReqRoundTrip);
+        if (!m) return 0;
+        if (mock.generating)
+                genWrite(TraceProtocols, m->protocols, 0, w);
+        else if (mock.next < mock.end && mock.next->kind == TraceProtocols &&
+                 mock.next->window == w)
+                m->protocols = mock.next->a;
+        *protocols = malloc(2 * sizeof(Atom));
+        if (!*protocols) return 0;
+        *count = 0;
+        if (m->protocols & PROTO_DELETE) (*protocols)[(*count)++] = atoms[WMDelete];
+        if (m->protocols & PROTO_SYNC) (*protocols)[(*count)++] = atoms[NetWMSyncRequest];
+        return 1;
+}
+int XDisplayKeycodes(Display *d, int *min, int *max) {
+        (void)d;
+        *min = 8;
+        *max = 255;
+        return 1;
+}
+KeySym *XGetKeyboardMapping(Display *d, KeyCode first, int count, int *perCode) {
+        (void)d;
+        mock.requests[ReqRoundTrip]++;
+        KeySym *syms = malloc(count * sizeof(KeySym));
+        if (!syms) return NULL;
+        for (int i = 0; i < count; i++) syms[i] = mock.keymap[(first + i) & 0xff];
+        *perCode = 1;
+        return syms;
+}
+int XRefreshKeyboardMapping(XMappingEvent *e) {
+        (void)e;
+        return 0;
+}
+int XGrabKey(Display *d, int code, unsigned int modifiers, Window w, Bool ownerEvents,
+             int pointerMode, int keyboardMode) {
+        (void)d;
+        (void)code;
+        (void)modifiers;
+        (void)ownerEvents;
+        (void)pointerMode;
+        (void)keyboardMode;
+        use(w, ReqGrab);
+        return 1;
+}
+int XUngrabKey(Display *d, int code, unsigned int modifiers, Window w) {
+        (void)d;
+        (void)code;
+        (void)modifiers;
+        use(w, ReqGrab);
+        return 1;
+}
+Window XCreateWindow(Display *d, Window parent, int x, int y, unsigned int w, unsigned int h,
+                     unsigned int border, int depth, unsigned int class, Visual *visual,
+                     unsigned long mask, XSetWindowAttributes *attr) {
+        (void)d;
+        (void)border;
+        (void)depth;
+        (void)class;
+        (void)visual;
+        (void)mask;
+        (void)attr;
+        if (!use(parent, ReqCreate)) return None;
+        MockWindow *m = mockAdd(mock.nextId++, parent);
+        m->own        = True;
+        m->x          = x;
+        m->y          = y;
+        m->w          = w;
+        m->h          = h;
+        return m->id;
+}
+Window XCreateSimpleWindow(Display *d, Window parent, int x, int y, unsigned int w,
+                           unsigned int h, unsigned int border, unsigned long borderPixel,
+                           unsigned long background) {
+        (void)borderPixel;
+        (void)background;
+        return XCreateWindow(d, parent, x, y, w, h, border, 0, 0, NULL, 0, NULL);
+}
+int XDestroyWindow(Display *d, Window w) {
+        (void)d;
+        MockWindow *m = use(w, ReqCreate);
+        if (m) m->alive = False;
+        return 1;
+}
+Cursor XCreateFontCursor(Display *d, unsigned int shape) {
+        (void)d;
+        (void)shape;
+        mock.requests[ReqOther]++;
+        return mock.nextId++;
+}
+int XDefineCursor(Display *d, Window w, Cursor cursor) {
+        (void)d;
+        (void)cursor;
+        use(w, ReqOther);
+        return 1;
+}
+int XSetCloseDownMode(Display *d, int mode) {
+        (void)d;
+        (void)mode;
+        mock.requests[ReqOther]++;
+        return 1;
+}
+int XSelectInput(Display *d, Window w, long mask) {
+        (void)d;
+        (void)mask;
+        use(w, ReqSelectInput);
+        return 1;
+}
+int XAddToSaveSet(Display *d, Window w) {
+        (void)d;
+        use(w, ReqSaveSet);
+        return 1;
+}
+int XRemoveFromSaveSet(Display *d, Window w) {
+        (void)d;
+        use(w, ReqSaveSet);
+        return 1;
+}
+int XChangeProperty(Display *d, Window w, Atom property, Atom type, int format, int mode,
+                    _Xconst unsigned char *data, int n) {
+        (void)d;
+        (void)type;
+        (void)format;
+        (void)mode;
+        (void)data;
+        (void)n;
+        use(w, ReqProperty);
+        // mwm counts the PropertyNotify its own _NET_WM_STATE writes cause
+        if (mock.generating && property == atoms[NetWMState])
+                queuePush(TracePropertyNotify, 2, 0, w);
+        return 1;
+}
+int XDeleteProperty(Display *d, Window w, Atom property) {
+        (void)d;
+        (void)property;
+        use(w, ReqProperty);
+        return 1;
+}
+int XMapWindow(Display *d, Window w) {
+        (void)d;
+        MockWindow *m = use(w, ReqMap);
+        if (m) m->mapped = True;
+        return 1;
+}
+int XUnmapWindow(Display *d, Window w) {
+        (void)d;
+        MockWindow *m = use(w, ReqUnmap);
+        if (m) m->mapped = False;
+        return 1;
+}
+int XResizeWindow(Display *d, Window w, unsigned int width, unsigned int height) {
+        (void)d;
+        MockWindow *m = use(w, ReqConfigure);
+        if (!m) return 1;
+        if (!width || !height) fail("resize of 0x%lx to %ux%u\n", w, width, height);
+        m->w = width;
+        m->h = height;
+        return 1;
+}
+int XConfigureWindow(Display *d, Window w, unsigned int mask, XWindowChanges *wc) {
+        (void)d;
+        MockWindow *m = use(w, ReqConfigure);
+        if (!m) return 1;
+        if (!mask) fail("empty configure of 0x%lx\n", w);
+        if (m->parent == ROOT && !m->own)
+                fail("configure of 0x%lx, which mwm does not parent\n", w);
+        if (mask & CWSibling) {
+                MockWindow *s = mockFind(wc->sibling);
+                if (!(mask & CWStackMode) || !s || s->parent != m->parent)
+                        fail("configure of 0x%lx against 0x%lx, no sibling\n", w, wc->sibling);
+        }
+        if (mask & CWX) m->x = wc->x;
+        if (mask & CWY) m->y = wc->y;
+        if (mask & CWWidth) m->w = wc->width;
+        if (mask & CWHeight) m->h = wc->height;
+        if ((mask & (CWWidth | CWHeight)) && (wc->width <= 0 || wc->height <= 0))
+                fail("configure of 0x%lx to %dx%d\n", w, wc->width, wc->height);
+        if ((mask & CWStackMode) && wc->stack_mode == Above) {
+                MockWindow *p = mockFind(m->parent);
+                if (p) p->top = w;
+        }
+        return 1;
+}
+int XReparentWindow(Display *d, Window w, Window parent, int x, int y) {
+        (void)d;
+        MockWindow *m = use(w, ReqReparent);
+        MockWindow *p = mockFind(parent);
+        if (!p || !p->alive) fail("reparent into unknown window 0x%lx\n", parent);
+        if (!m || !p || !p->alive) return 1;
+        // the server unmaps a mapped window around the reparent and tells
+        // the old parent's SubstructureNotify selection
+        if (m->mapped) {
+                m->reparentUnmaps++;
+                if (mock.generating) queuePush(TraceUnmapNotify, 0, 0, w);
+        }
+        m->parent = parent;
+        m->x      = x;
+        m->y      = y;
+        p->top    = w;
+        return 1;
+}
+// RevertToParent focus on an unmapped window is BadMatch.
+int XSetInputFocus(Display *d, Window w, int revertTo, Time time) {
+        (void)d;
+        (void)revertTo;
+        (void)time;
+        MockWindow *m = use(w, ReqFocus);
+        if (!m) return 1;
+        if (!viewable(m)) fail("focus on unviewable window 0x%lx\n", w);
+        mock.focus = w;
+        return 1;
+}
+Status XSendEvent(Display *d, Window w, Bool propagate, long mask, XEvent *e) {
+        (void)d;
+        (void)propagate;
+        (void)mask;
+        MockWindow *m = use(w, ReqSendEvent);
+        if (!m) return 0;
+        if (e->type != ClientMessage || e->xclient.message_type != atoms[WMProtocols]) return 1;
+        if ((Atom)e->xclient.data.l[0] == atoms[WMDelete]) {
+                if (!(m->protocols & PROTO_DELETE)) fail("WM_DELETE_WINDOW to 0x%lx\n", w);
+                clientExits(m);
+        } else if ((Atom)e->xclient.data.l[0] == atoms[NetWMSyncRequest]) {
+                if (!(m->protocols & PROTO_SYNC)) fail("sync request to 0x%lx\n", w);
+                // the client redraws and bumps its counter, or never does
+                if (mock.generating && rnd(4)) queuePush(TraceSyncAlarm, 0, 0, w);
+        }
+        return 1;
+}
+int XKillClient(Display *d, XID resource) {
+        (void)d;
+        MockWindow *m = use(resource, ReqKill);
+        if (m) clientExits(m);
+        return 1;
+}
+Status XSyncQueryExtension(Display *d, int *eventBase, int *errorBase) {
+        (void)d;
+        *eventBase = LASTEvent;
+        *errorBase = 0;
+        return True;
+}
+Status XSyncInitialize(Display *d, int *major, int *minor) {
+        (void)d;
+        *major = 3;
+        *minor = 1;
+        return True;
+}
+XSyncAlarm XSyncCreateAlarm(Display *d, unsigned long mask, XSyncAlarmAttributes *attr) {
+        (void)d;
+        (void)mask;
+        (void)attr;
+        mock.requests[ReqAlarm]++;
+        return mock.nextId++;
+}
+Status XSyncChangeAlarm(Display *d, XSyncAlarm alarm, unsigned long mask,
+                        XSyncAlarmAttributes *attr) {
+        (void)d;
+        (void)alarm;
+        (void)mask;
+        (void)attr;
+        mock.requests[ReqAlarm]++;
+        return True;
+}
+Status XSyncDestroyAlarm(Display *d, XSyncAlarm alarm) {
+        (void)d;
+        (void)alarm;
+        mock.requests[ReqAlarm]++;
+        return True;
+}
+void XSyncIntToValue(XSyncValue *v, int i) {
+        v->hi = i < 0 ? ~0 : 0;
+        v->lo = i;
+}
+void XSyncIntsToValue(XSyncValue *v, unsigned int lo, int hi) {
+        v->hi = hi;
+        v->lo = lo;
+}
+// launchers and the audio helper are counted, never started: mwm only ever
+// sees the parent side
+pid_t fork(void) {
+        mock.requests[ReqSpawn]++;
+        return 1;
+}
+// Writes to the audio helper and control socket replies. The helper fails a
+// write where the trace says it went away, and otherwise answers it.
+ssize_t send(int fd, const void *buf, size_t len, int flags) {
+        (void)flags;
+        if (fd < 0 || fd != audioSource.fd) {
+                mock.requests[ReqReply]++;
+                return len;
+        }
+        mock.requests[ReqAudio]++;
+        _Bool gone = mock.generating ? !rnd(2000)
+                                     : mock.next < mock.end && mock.next->kind == TraceAudio &&
+                                           mock.next->b;
+        if (gone) {
+                if (mock.generating) genWrite(TraceAudio, 0, 1, 0);
+                errno = EPIPE;
+                return -1;
+        }
+        if (!mock.generating) return len;
+        char reply[16];
+        int n;
+        switch (*(const char *)buf) {
+                case 'a':
+                        n = snprintf(reply, sizeof(reply), "aud %s", rnd(2) ? "on" : "off");
+                        break;
+                case 'm':
+                        n = snprintf(reply, sizeof(reply), "mic %s", rnd(2) ? "on" : "off");
+                        break;
+                default:
+                        n = snprintf(reply, sizeof(reply), "vol %u%%", rnd(101));
+                        break;
+        }
+        queueText(TraceAudio, reply, n, 0);
+        return len;
+}
+int replayClock(clockid_t id, struct timespec *ts) {
+        (void)id;
+        ts->tv_sec  = mock.clockMs / 1000;
+        ts->tv_nsec = mock.clockMs % 1000 * 1000000;
+        return 0;
+}
+XFontStruct *XLoadQueryFont(Display *d, _Xconst char *name) {
+        static XFontStruct font = {.ascent = 12, .descent = 3};
+        (void)d;
+        (void)name;
+        mock.requests[ReqRoundTrip]++;
+        font.fid = mock.nextId++;
+        return &font;
+}
+int XFreeFont(Display *d, XFontStruct *font) {
+        (void)d;
+        (void)font;
+        mock.requests[ReqOther]++;
+        return 1;
+}
+int XTextWidth(XFontStruct *font, _Xconst char *text, int len) {
+        (void)font;
+        (void)text;
+        return 7 * len;
+}
+GC XCreateGC(Display *d, Drawable w, unsigned long mask, XGCValues *values) {
+        static char gc;// only ever handed back to the stubs
+        (void)d;
+        (void)mask;
+        (void)values;
+        use(w, ReqCreate);
+        return (GC)&gc;
+}
+int XFreeGC(Display *d, GC gc) {
+        (void)d;
+        (void)gc;
+        mock.requests[ReqOther]++;
+        return 1;
+}
+int XClearWindow(Display *d, Window w) {
+        (void)d;
+        use(w, ReqOther);
+        return 1;
+}
+int XDrawString(Display *d, Drawable w, GC gc, int x, int y, _Xconst char *text, int len) {
+        (void)d;
+        (void)gc;
+        (void)x;
+        (void)y;
+        (void)text;
+        (void)len;
+        use(w, ReqOther);
+        return 1;
+}
+
+// What the server would show after the batch has to match what mwm believes.
+static void checkState(void) {
+        static Geometry *expected;
+        static unsigned short expectedLen;
+        unsigned int total = 0;
+        for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
+                Desktop *dk       = &desktops[d];
+                MockWindow *cont  = mockFind(dk->container);
+                if (!cont || cont->mapped != (d == currentDesktop))
+                        fail("desktop %u container %s\n", d + 1,
+                             d == currentDesktop ? "not mapped" : "mapped while hidden");
+                if (dk->windowCount ? dk->focusedIdx >= dk->windowCount : dk->focusedIdx != 0)
+                        fail("desktop %u focusedIdx %u with %u windows\n", d + 1, dk->focusedIdx,
+                             dk->windowCount);
+                for (unsigned short i = 0; i < dk->windowCount; i++) {
+                        Client *c     = dk->clients[i];
+                        MockWindow *m = mockFind(c->win);
+                        if (c->slot != i || c->desktop != d)
+                                fail("0x%lx in slot %u of desktop %u thinks %u of %u\n", c->win,
+                                     i, d + 1, c->slot, c->desktop + 1);
+                        if (clientLookup(c->win) != c) fail("0x%lx not indexed\n", c->win);
+                        if (!m || !m->alive)
+                                fail("destroyed window 0x%lx still managed\n", c->win);
+                        else if (m->parent != dk->container)
+                                fail("0x%lx managed on desktop %u but not parented there\n",
+                                     c->win, d + 1);
+                }
+                total += dk->windowCount;
+        }
+        if (total != windowIndex.used || total != clientListLen)
+                fail("%u clients, %u indexed, %u in _NET_CLIENT_LIST\n", total, windowIndex.used,
+                     clientListLen);
+        if (screen_width != mock.width || screen_height != mock.height)
+                fail("screen %ux%u, root is %ux%u\n", screen_width, screen_height, mock.width,
+                     mock.height);
+        const unsigned short n = CURRENT_DESKTOP.windowCount;
+        if (!n) return;
+        if (n > expectedLen) {
+                expected    = realloc(expected, n * sizeof(Geometry));
+                expectedLen = n;
+                if (!expected) die();
+        }
+        layoutApply(CURRENT_DESKTOP.layout, n, screen_width, screen_height,
+                    resizeDelta[currentDesktop], expected);
+        for (unsigned short i = 0; i < n; i++) {
+                Client *c     = CURRENT_DESKTOP.clients[i];
+                MockWindow *m = mockFind(c->win);
+                Geometry *g   = &expected[i];
+                // a resize waits for the client to answer the last sync request
+                if (m && !c->syncPending &&
+                    (m->x != g->x || m->y != g->y || m->w != g->w || m->h != g->h))
+                        fail("0x%lx at %ux%u%+d%+d, layout wants %ux%u%+d%+d\n", m->id, m->w,
+                             m->h, m->x, m->y, g->w, g->h, g->x, g->y);
+        }
+        MockWindow *cur = mockFind(CURRENT_DESKTOP.container);
+        Window focused  = CURRENT_DESKTOP.clients[CURRENT_DESKTOP.focusedIdx]->win;
+        if (mock.focus != focused)
+                fail("input focus on 0x%lx, focusedIdx on 0x%lx\n", mock.focus, focused);
+        // windows overlap only in monocle, where the focused one must be seen
+        if (CURRENT_DESKTOP.layout == LayoutMonocle && cur->top != focused)
+                fail("focused 0x%lx not on top in monocle\n", focused);
+}
+static _Bool checking = True;
+// the atoms of TracePropertyNotify, by its a
+static const unsigned char traceProps[] = {WMProtocols, NetWMSyncRequestCounter, NetWMState};
+// Turns one record back into the XEvent mwm would have read; False for a
+// batch end.
+static _Bool toEvent(const TraceRecord *r, XEvent *e) {
+        MockWindow *m = r->window ? mockFind(r->window) : NULL;
+        memset(e, 0, sizeof(*e));
+        switch (r->kind) {
+                case TraceKeyPress:
+                        e->type         = KeyPress;
+                        e->xkey.window  = ROOT;
+                        e->xkey.root    = ROOT;
+                        e->xkey.keycode = r->a;
+                        e->xkey.state   = r->b;
+                        return True;
+                case TraceMapRequest:
+                        e->type               = MapRequest;
+                        e->xmaprequest.parent = ROOT;
+                        e->xmaprequest.window = r->window;
+                        return True;
+                case TraceUnmapNotify:
+                        e->type          = UnmapNotify;
+                        e->xunmap.event  = m ? m->parent : ROOT;
+                        e->xunmap.window = r->window;
+                        return True;
+                case TraceDestroyNotify:
+                        e->type                  = DestroyNotify;
+                        e->xdestroywindow.event  = ROOT;
+                        e->xdestroywindow.window = r->window;
+                        return True;
+                case TracePropertyNotify:
+                        if (r->a >= ARRAY_LEN(traceProps)) return False;
+                        e->type             = PropertyNotify;
+                        e->xproperty.window = r->window;
+                        e->xproperty.atom   = atoms[traceProps[r->a]];
+                        e->xproperty.state  = PropertyNewValue;
+                        return True;
+                case TraceMappingNotify:
+                        e->type                   = MappingNotify;
+                        e->xmapping.request       = r->a;
+                        e->xmapping.first_keycode = 8;
+                        e->xmapping.count         = 248;
+                        return True;
+                case TraceRootResize:
+                        e->type               = ConfigureNotify;
+                        e->xconfigure.event   = ROOT;
+                        e->xconfigure.window  = ROOT;
+                        e->xconfigure.width   = r->b;
+                        e->xconfigure.height  = r->window;
+                        return True;
+                case TraceSyncAlarm: {
+                        Client *c                 = clientLookup(r->window);
+                        XSyncAlarmNotifyEvent *ev = (XSyncAlarmNotifyEvent *)e;
+                        ev->type                  = syncEventBase + XSyncAlarmNotify;
+                        ev->alarm                 = c ? c->alarm : None;
+                        return True;
+                }
+        }
+        return False;
+}
+// mwm only peeks at its queue; removing events is not modelled.
+Bool XCheckIfEvent(Display *d, XEvent *e, Bool (*predicate)(Display *, XEvent *, XPointer),
+                   XPointer arg) {
+        const TraceRecord *r;
+        for (unsigned int i = 0; (r = ahead(i)); i++) {
+                if (!toEvent(r, e) || !predicate(d, e, arg)) continue;
+                fail("XCheckIfEvent would remove a queued event\n");
+                return True;
+        }
+        return False;
+}
+// A line from a control socket client, as readControl() would have collected it.
+static void feedControl(const TraceRecord *r) {
+        static ControlConn conn = {{-1, NULL}, 0, False, {0}};
+        if (r->a >= CONTROL_LINE) {
+                fail("control line of %u bytes\n", r->a);
+                return;
+        }
+        memcpy(conn.buf, r + 1, r->a);
+        conn.len      = r->a;
+        conn.overlong = r->b;
+        controlLine(&conn);
+        need_flush = True;
+}
+// Keeps the stub server in step with what the event says happened, then
+// hands it to mwm.
+static void feed(const TraceRecord *r) {
+        XEvent e;
+        MockWindow *m = r->window ? mockFind(r->window) : NULL;
+        Client *c;
+        mock.records++;
+        switch (r->kind) {
+                case TraceMapRequest:
+                        // a window the trace has not seen yet is a new top-level
+                        if (!m || !m->alive) mockAdd(r->window, ROOT);
+                        break;
+                case TraceUnmapNotify:
+                        if (!m) break;
+                        if (m->reparentUnmaps) {
+                                m->reparentUnmaps--;
+                                break;
+                        }
+                        m->mapped      = False;
+                        m->withdrawnIn = mock.batches + 1;
+                        // withdrawn and destroyed in one batch: the client has
+                        // exited, and the window is already gone
+                        for (unsigned int i = 0; ahead(i); i++) {
+                                const TraceRecord *q = ahead(i);
+                                if (q->window != r->window || q->kind > TraceRootResize) continue;
+                                if (q->kind == TraceDestroyNotify) m->alive = False;
+                                break;
+                        }
+                        break;
+                case TraceDestroyNotify:
+                        if (m) m->alive = False;
+                        break;
+                case TraceRootResize:
+                        mock.width  = r->b;
+                        mock.height = r->window;
+                        break;
+                case TraceSyncAlarm:
+                        c = clientLookup(r->window);
+                        if (!c || c->alarm == None) {
+                                fail("sync alarm for 0x%lx, which has none\n", r->window);
+                                return;
+                        }
+                        break;
+                case TraceBatchEnd:
+                        mock.clockMs = CLOCK_BASE + r->window;
+                        finishBatch();
+                        mock.batches++;
+                        if (checking) checkState();
+                        return;
+                case TraceTimer:
+                        mock.clockMs = CLOCK_BASE + r->window;
+                        mock.events++;
+                        if (r->a >= TimerLast || !timerDeadline[r->a])
+                                fail("timer %u fired but is not armed\n", r->a);
+                        else
+                                fireTimer(r->a);
+                        return;
+                case TraceProtocols:
+                        c = clientLookup(r->window);
+                        if (!c || c->protocols != r->a)
+                                fail("0x%lx has protocols %u, not %u\n", r->window,
+                                     c ? c->protocols : 0, r->a);
+                        return;
+                case TraceKeysym:
+                        mock.keymap[r->a] = r->window;
+                        return;
+                case TraceControl:
+                        mock.events++;
+                        feedControl(r);
+                        return;
+                case TraceAudio:
+                        // a failed write already dropped the helper
+                        if (r->b && audioSource.fd >= 0) removeSource(&audioSource);
+                        if (r->b) return;
+                        mock.events++;
+                        if (audioSource.fd < 0) fail("audio reply without the helper\n");
+                        else showOsd((const char *)(r + 1), r->a);
+                        return;
+        }
+        if (!toEvent(r, &e)) {
+                fail("unknown record kind %u\n", r->kind);
+                return;
+        }
+        mock.events++;
+        handleEvent(&e);
+}
+
+typedef struct {
+        unsigned char code;
+        unsigned short state;
+} GenKey;
+// bound keys except quit, restart and the launchers that only spawn
+static const GenKey genKeys[] = {
+    {10, MOD_KEY}, {11, MOD_KEY}, {12, MOD_KEY}, {13, MOD_KEY}, {14, MOD_KEY}, {15, MOD_KEY},
+    {16, MOD_KEY}, {17, MOD_KEY}, {18, MOD_KEY}, {10, MOD_KEY | ShiftMask},
+    {11, MOD_KEY | ShiftMask}, {12, MOD_KEY | ShiftMask}, {13, MOD_KEY | ShiftMask},
+    {44, MOD_KEY}, {44, MOD_KEY}, {45, MOD_KEY}, {45, MOD_KEY}, {43, MOD_KEY | ShiftMask},
+    {46, MOD_KEY | ShiftMask}, {65, MOD_KEY}, {24, MOD_KEY}, {121, MOD_KEY}, {122, MOD_KEY},
+    {123, MOD_KEY}, {198, MOD_KEY}};
+// control socket lines, good and bad
+static const char *const genLines[] = {
+    "desktop 3", "desktop 12", "move 2",      "focus next",  "focus prev", "resize 40",
+    "resize -40", "layout next", "layout bogus", "get clients", "get focused", "kill", "bogus"};
+static const unsigned short genSizes[][2] = {{1920, 1080}, {1280, 1024}, {2560, 1440}};
+static Window genLive[GEN_MAX_WINDOWS];
+static unsigned int genLen = 0;
+static Window genNext      = GEN_FIRST_WINDOW;
+// One thing a user or a client does; its events go through the queue like
+// the server's replies.
+static void genAction(void) {
+        unsigned int roll = rnd(100);
+        if (roll < 15 && genLen < GEN_MAX_WINDOWS) {
+                genLive[genLen++] = genNext;
+                queuePush(TraceMapRequest, 0, 0, genNext++);
+        } else if (roll < 25 && genLen) {
+                MockWindow *m = mockFind(genLive[rnd(genLen)]);
+                if (m->mapped) {
+                        // the client withdraws the window, and may exit
+                        queuePush(TraceUnmapNotify, 0, 0, m->id);
+                        if (rnd(2)) queuePush(TraceDestroyNotify, 0, 0, m->id);
+                } else if (m->withdrawnIn == mock.batches + 1) {
+                        // destroying it now would make the unmap look like an
+                        // exit to a replay, which sees the whole batch
+                        queuePush(TraceMapRequest, 0, 0, m->id);
+                } else {
+                        queuePush(rnd(2) ? TraceMapRequest : TraceDestroyNotify, 0, 0, m->id);
+                }
+        } else if (roll < 27) {
+                const unsigned short *size = genSizes[rnd(ARRAY_LEN(genSizes))];
+                queuePush(TraceRootResize, 0, size[0], size[1]);
+        } else if (roll < 28 && genLen) {
+                // a client may drop or take up sync requests with WM_PROTOCOLS
+                MockWindow *m      = mockFind(genLive[rnd(genLen)]);
+                unsigned char prop = rnd(ARRAY_LEN(traceProps));
+                if (prop == 0 && !rnd(4)) m->protocols ^= PROTO_SYNC;
+                queuePush(TracePropertyNotify, prop, 0, m->id);
+        } else if (roll < 29 && !rnd(10)) {
+                queuePush(TraceMappingNotify, MappingKeyboard, 0, 0);
+        } else if (roll < 32) {
+                char line[CONTROL_LINE];
+                if (rnd(20)) {
+                        const char *text = genLines[rnd(ARRAY_LEN(genLines))];
+                        queueText(TraceControl, text, strlen(text), 0);
+                } else {
+                        // readControl() keeps what fits of an overlong line
+                        memset(line, 'x', sizeof(line) - 1);
+                        queueText(TraceControl, line, sizeof(line) - 1, 1);
+                }
+        } else {
+                const GenKey *k = &genKeys[rnd(ARRAY_LEN(genKeys))];
+                queuePush(TraceKeyPress, k->code, k->state, 0);
+        }
+}
+static void emit(FILE *out, const TraceRecord *r) {
+        fwrite(r, sizeof(*r), nextRecord(r) - r, out);
+        feed(r);
+        if (r->kind != TraceDestroyNotify) return;
+        for (unsigned int i = 0; i < genLen; i++) {
+                if (genLive[i] != r->window) continue;
+                genLive[i] = genLive[--genLen];
+                break;
+        }
+}
+// Random actions only start once the server has answered the previous ones.
+// Each batch starts a few milliseconds after the last, with the timers that
+// have come due by then.
+static void generate(FILE *out, unsigned long events) {
+        mock.out = out;
+        while (mock.events < events) {
+                mock.clockMs += 1 + rnd(30);
+                for (unsigned char t = 0; t < TimerLast; t++) {
+                        if (!timerDeadline[t] || timerDeadline[t] > mock.clockMs) continue;
+                        TraceRecord timer = {TraceTimer, t, 0, mock.clockMs - CLOCK_BASE};
+                        emit(out, &timer);
+                }
+                unsigned int batch = 1 + rnd(GEN_BATCH);
+                for (unsigned int i = 0; i < batch; i++) {
+                        if (!mock.qlen) genAction();
+                        TraceRecord r[1 + TRACE_PAYLOAD(255)];
+                        queuePop(r);
+                        // the alarm went with the client, or with a restart
+                        // of its management
+                        Client *c = r->kind == TraceSyncAlarm ? clientLookup(r->window) : NULL;
+                        if (r->kind == TraceSyncAlarm && (!c || c->alarm == None)) continue;
+                        // an exiting client's UnmapNotify and DestroyNotify
+                        // arrive together
+                        const TraceRecord *q = &mock.queue[mock.qhead];
+                        if (i + 1 == batch && r->kind == TraceUnmapNotify && mock.qlen &&
+                            q->kind == TraceDestroyNotify && q->window == r->window)
+                                batch++;
+                        mock.batchLeft = batch - i - 1;
+                        emit(out, r);
+                }
+                TraceRecord end = {TraceBatchEnd, 0, 0, mock.clockMs - CLOCK_BASE};
+                emit(out, &end);
+        }
+}
+static double nowSeconds(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+static void report(double seconds) {
+        unsigned long total = 0;
+        printf("replay: %lu events in %lu batches, %.3fs, %.2fM events/s\nreplay: requests",
+               mock.events, mock.batches, seconds, mock.events / seconds / 1e6);
+        for (unsigned char i = 0; i < ReqLast; i++) {
+                if (!mock.requests[i]) continue;
+                printf(" %s %lu", reqNames[i], mock.requests[i]);
+                if (i < ReqFlush) total += mock.requests[i];
+        }
+        printf("\nreplay: %.2f requests per event, %lu errors\n",
+               mock.events ? (double)total / mock.events : 0.0, mock.errors);
+}
+int main(int argc, char *argv[]) {
+        unsigned long generateEvents = 0;
+        int opt;
+        while ((opt = getopt(argc, argv, "qg:s:")) != -1) {
+                switch (opt) {
+                        case 'q':
+                                checking = False;
+                                break;
+                        case 'g':
+                                generateEvents = strtoul(optarg, NULL, 10);
+                                break;
+                        case 's':
+                                rng = strtoull(optarg, NULL, 0) | 1;
+                                break;
+                        default:
+                                optind = argc;
+                                break;
+                }
+        }
+        if (optind != argc - 1) {
+                fprintf(stderr, "usage: %s [-q] [-g events [-s seed]] trace\n", argv[0]);
+                return 2;
+        }
+        FILE *f = fopen(argv[optind], generateEvents ? "w" : "r");
+        if (!f) {
+                perror(argv[optind]);
+                return 2;
+        }
+        TraceHeader h = {TRACE_MAGIC, TRACE_VERSION, genSizes[0][0], genSizes[0][1], 0, {0}};
+        TraceRecord *records = NULL;
+        size_t n             = 0;
+        if (generateEvents) {
+                memcpy(h.keymap, genKeymap, sizeof(h.keymap));
+                // rnd() picks the protocols of new windows from here on
+                mock.generating = True;
+        } else {
+                struct stat st;
+                if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, TRACE_MAGIC, 3) ||
+                    h.version != TRACE_VERSION || fstat(fileno(f), &st) == -1) {
+                        fprintf(stderr, "%s: not a version %d trace\n", argv[optind],
+                                TRACE_VERSION);
+                        return 2;
+                }
+                n       = (st.st_size - sizeof(h)) / sizeof(TraceRecord);
+                records = malloc(n * sizeof(TraceRecord) + 1);
+                if (!records || fread(records, sizeof(TraceRecord), n, f) != n) {
+                        perror(argv[optind]);
+                        return 2;
+                }
+        }
+        mock.width  = h.width;
+        mock.height = h.height;
+        memcpy(mock.keymap, h.keymap, sizeof(mock.keymap));
+        // no control socket, and a $DISPLAY for setup() to find
+        setenv("MWM_SOCKET", "", 1);
+        setenv("DISPLAY", ":replay", 0);
+        setup();
+        // setup() blocked these for its signalfd
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        if (generateEvents) {
+                if (audioSource.fd >= 0) h.flags |= TRACE_HELPER;
+                fwrite(&h, sizeof(h), 1, f);
+        } else if (!(h.flags & TRACE_HELPER) && audioSource.fd >= 0) {
+                // media keys went to AUDIO_SCRIPT in the traced session
+                removeSource(&audioSource);
+        }
+        memset(mock.requests, 0, sizeof(mock.requests));
+        double start = nowSeconds();
+        if (generateEvents) {
+                generate(f, generateEvents);
+        } else {
+                mock.end = records + n;
+                for (const TraceRecord *r = records; r < mock.end && running; r = mock.next) {
+                        mock.next = nextRecord(r);
+                        if (mock.next > mock.end) {
+                                fail("trace ends inside a record\n");
+                                break;
+                        }
+                        feed(r);
+                }
+        }
+        report(nowSeconds() - start);
+        if (fclose(f)) perror(argv[optind]);
+        free(records);
+        return mock.errors != 0;
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Runs mwm under a private Xvfb and drives it with bench/bench.
+# Usage: bench/run.sh [bench options]   (BENCH_DISPLAY overrides :99)
+set -e
+cd "$(dirname "$0")/.."
+display="${BENCH_DISPLAY:-:99}"
+command -v Xvfb > /dev/null || { echo "bench: Xvfb is not installed" >&2; exit 1; }
+
+Xvfb "$display" -screen 0 1920x1080x24 -nolisten tcp > /dev/null 2>&1 &
+xvfb=$!
+mwm=
+trap 'kill $mwm $xvfb 2> /dev/null' EXIT INT TERM
+socket="/tmp/.X11-unix/X${display#:}"
+tries=0
+while [ ! -S "$socket" ]; do
+    tries=$((tries + 1))
+    [ "$tries" -gt 100 ] && { echo "bench: Xvfb did not start" >&2; exit 1; }
+    sleep 0.05
+done
+
+DISPLAY="$display" ./mwm &
+mwm=$!
+DISPLAY="$display" ./bench/bench "$@"
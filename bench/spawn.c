@@ -0,0 +1,119 @@
+// Keypress-to-exec latency of the launcher path: the old fork+fork+/bin/sh -c,
+// posix_spawn with a pre-parsed argv, and launchSpawn(), which forks and
+// execs that argv in the child.
+//
+//   bench/spawn [iterations] [command]
+//
+// "call" is how long mwm's event loop is blocked by the spawn; "exit" is the
+// time until the launched command has run and exited, measured through a pipe
+// whose write end every process in the chain inherits.
+#define _GNU_SOURCE
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../launch.h"
+#define DEFAULT_ITERATIONS 500
+#define DEFAULT_COMMAND "true"
+
+static double nowUs(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+static void legacySpawn(char *const *argv, const char *command) {
+        (void)argv;
+        if (fork() == 0) {
+                if (fork() == 0) {
+                        setsid();
+                        for (int fd = 0; fd <= 2; fd++) close(fd);
+                        execl("/bin/sh", "sh", "-c", command, NULL);
+                        _exit(EXIT_FAILURE);
+                }
+                _exit(EXIT_SUCCESS);
+        }
+}
+// What launchSpawn() did before it forked: no intermediate process either, but
+// the caller stays suspended until the exec has finished.
+static void posixSpawn(char *const *argv, const char *command) {
+        static posix_spawnattr_t attr;
+        static posix_spawn_file_actions_t actions;
+        static _Bool ready = 0;
+        if (!ready) {
+                sigset_t none, dfl;
+                sigemptyset(&none);
+                sigemptyset(&dfl);
+                sigaddset(&dfl, SIGCHLD);
+                sigaddset(&dfl, SIGPIPE);
+                posix_spawnattr_init(&attr);
+                posix_spawnattr_setflags(
+                    &attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+                posix_spawnattr_setsigmask(&attr, &none);
+                posix_spawnattr_setsigdefault(&attr, &dfl);
+                posix_spawn_file_actions_init(&actions);
+                for (int fd = 0; fd <= 2; fd++)
+                        posix_spawn_file_actions_addopen(&actions, fd, "/dev/null", O_RDWR, 0);
+                ready = 1;
+        }
+        pid_t pid;
+        if (argv[0]) {
+                posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+        } else {
+                char *sh[] = {"sh", "-c", (char *)command, NULL};
+                posix_spawn(&pid, "/bin/sh", &actions, &attr, sh, environ);
+        }
+}
+static void forkSpawn(char *const *argv, const char *command) { launchSpawn(argv, command); }
+static int cmpDouble(const void *a, const void *b) {
+        double x = *(const double *)a, y = *(const double *)b;
+        return (x > y) - (x < y);
+}
+static void report(const char *name, const char *what, double *samples, int n) {
+        qsort(samples, n, sizeof(double), cmpDouble);
+        printf("%-12s %-5s p50 %8.1fus  p90 %8.1fus  p99 %8.1fus\n", name, what,
+               samples[n / 2], samples[n * 90 / 100], samples[n * 99 / 100]);
+}
+static void run(const char *name, int n, const char *command, char **argv,
+                void (*spawn)(char *const *, const char *)) {
+        double *call = malloc(n * sizeof(double));
+        double *done = malloc(n * sizeof(double));
+        if (!call || !done) exit(1);
+        for (int i = 0; i < n; i++) {
+                int p[2];
+                char c;
+                // only the write end is inherited
+                if (pipe2(p, O_CLOEXEC) == -1) exit(1);
+                fcntl(p[1], F_SETFD, 0);
+                double t0 = nowUs();
+                spawn(argv, command);
+                double t1 = nowUs();
+                close(p[1]);
+                while (read(p[0], &c, 1) > 0);
+                double t2 = nowUs();
+                close(p[0]);
+                call[i] = t1 - t0;
+                done[i] = t2 - t0;
+        }
+        report(name, "call", call, n);
+        report(name, "exit", done, n);
+        free(call);
+        free(done);
+}
+int main(int argc, char *argv[]) {
+        int n               = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+        const char *command = argc > 2 ? argv[2] : DEFAULT_COMMAND;
+        if (n <= 0) n = DEFAULT_ITERATIONS;
+        // children are reaped by the kernel; mwm reaps them from its signalfd
+        signal(SIGCHLD, SIG_IGN);
+        char *buf = strdup(command);
+        char *parsed[LAUNCH_MAX_ARGS];
+        if (!buf || !launchParse(buf, parsed)) parsed[0] = NULL;
+        printf("%d launches of \"%s\" (%s)\n", n, command,
+               parsed[0] ? "argv" : "needs /bin/sh -c");
+        run("fork+sh", n, command, parsed, legacySpawn);
+        run("posix_spawn", n, command, parsed, posixSpawn);
+        run("launchSpawn", n, command, parsed, forkSpawn);
+        free(buf);
+        return 0;
+}
@@ -0,0 +1,75 @@
+// Open-addressing table from X ids to clients, shared by main.c (windows and
+// sync alarms) and mwm-xcb.c (windows). Each slot keeps the id next to the
+// client, so probing never touches the clients themselves. Every XID fits
+// in 29 bits, whichever client library handed it out.
+#include <stdint.h>
+#include <stdlib.h>
+// starting size, power of two; the table is kept at most half full
+#define INDEX_SIZE 256
+typedef struct {
+        uint32_t id;
+        void *item;// NULL for an empty slot
+} IndexSlot;
+typedef struct {
+        IndexSlot *slots;
+        unsigned int mask, used;
+} XidIndex;
+// Returns 0 if the table cannot be allocated.
+static _Bool indexInit(XidIndex *x) {
+        x->slots = calloc(INDEX_SIZE, sizeof(IndexSlot));
+        x->mask  = INDEX_SIZE - 1;
+        x->used  = 0;
+        return x->slots != NULL;
+}
+// Fibonacci hashing spreads the sequential XIDs a client allocates.
+static inline unsigned int indexSlot(const XidIndex *x, uint32_t id) {
+        return (unsigned int)((id * 0x9E3779B97F4A7C15ull) >> 32) & x->mask;
+}
+static void *indexLookup(const XidIndex *x, uint32_t id) {
+        for (unsigned int i = indexSlot(x, id);; i = (i + 1) & x->mask) {
+                const IndexSlot *s = &x->slots[i];
+                if (!s->item || s->id == id) return s->item;
+        }
+}
+static void indexPlace(XidIndex *x, uint32_t id, void *item) {
+        unsigned int i = indexSlot(x, id);
+        while (x->slots[i].item) i = (i + 1) & x->mask;
+        x->slots[i] = (IndexSlot){id, item};
+        x->used++;
+}
+// Doubles the table before it gets more than half full. Returns 0 if that
+// allocation fails; the table is then unchanged.
+static _Bool indexInsert(XidIndex *x, uint32_t id, void *item) {
+        if ((x->used + 1) * 2 > x->mask + 1) {
+                IndexSlot *old      = x->slots;
+                unsigned int oldLen = x->mask + 1;
+                IndexSlot *grown    = calloc(oldLen * 2, sizeof(IndexSlot));
+                if (!grown) return 0;
+                x->slots = grown;
+                x->mask  = oldLen * 2 - 1;
+                x->used  = 0;
+                for (unsigned int i = 0; i < oldLen; i++) {
+                        if (old[i].item) indexPlace(x, old[i].id, old[i].item);
+                }
+                free(old);
+        }
+        indexPlace(x, id, item);
+        return 1;
+}
+// Linear probing with backward-shift deletion, so no tombstones build up. An
+// id that is not indexed leaves the table alone.
+static void indexRemove(XidIndex *x, uint32_t id) {
+        unsigned int i = indexSlot(x, id);
+        while (x->slots[i].item && x->slots[i].id != id) i = (i + 1) & x->mask;
+        if (!x->slots[i].item) return;
+        for (unsigned int j = (i + 1) & x->mask; x->slots[j].item; j = (j + 1) & x->mask) {
+                unsigned int home = indexSlot(x, x->slots[j].id);
+                // move j into the hole at i unless its home lies in (i, j]
+                if (((j - home) & x->mask) >= ((j - i) & x->mask)) {
+                        x->slots[i] = x->slots[j];
+                        i           = j;
+                }
+        }
+        x->slots[i].item = NULL;
+        x->used--;
+}
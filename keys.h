@@ -0,0 +1,81 @@
+// Key bindings shared by main.c and mwm-xcb.c. keyBind() resolves them into
+// keyTable, indexed by keycode and by whether Shift is held, each time the
+// keyboard mapping is read, so a KeyPress costs one lookup instead of a keysym
+// translation and a chain of comparisons. Needs MAX_DESKTOPS defined first.
+#include <X11/X.h>
+#include <X11/XF86keysym.h>
+#include <X11/keysym.h>
+#define MOD_KEY Mod4Mask
+#ifndef AUDIO_SCRIPT
+#define AUDIO_SCRIPT ""
+#endif
+typedef struct {
+        unsigned long keysym;
+        const char *command;
+} AppLauncher;
+static AppLauncher launchers[6] = {{XK_Return, "st"},
+                                   {XK_p,
+                                    "dmenu_run -m '0' -nb '#000000' -nf '#ffffff' -sb "
+                                    "'#ffffff' -sf '#000000'"},
+                                   {XF86XK_AudioRaiseVolume, AUDIO_SCRIPT " +"},
+                                   {XF86XK_AudioLowerVolume, AUDIO_SCRIPT " -"},
+                                   {XF86XK_AudioMicMute, AUDIO_SCRIPT " mic"},
+                                   {XF86XK_AudioMute, AUDIO_SCRIPT " aud"}};
+// Bindings besides launchers[] and the Mod(+Shift)+1..9 desktop keys. mwm-xcb
+// cannot restart and ignores ActRestart.
+enum {
+        ActNone,
+        ActQuit,
+        ActRestart,
+        ActKill,
+        ActFocus,
+        ActResize,
+        ActLayout,
+        ActDesktop,
+        ActMove,
+        ActLaunch
+};
+typedef struct {
+        unsigned long keysym;
+        unsigned int modifiers;
+        unsigned char action;
+        unsigned char arg;
+} Binding;
+static const Binding bindings[] = {
+    {XK_q, MOD_KEY | ShiftMask, ActQuit, 0},    {XK_r, MOD_KEY | ShiftMask, ActRestart, 0},
+    {XK_q, MOD_KEY, ActKill, 0},                {XK_j, MOD_KEY, ActFocus, 1},
+    {XK_k, MOD_KEY, ActFocus, 0},               {XK_l, MOD_KEY | ShiftMask, ActResize, 1},
+    {XK_h, MOD_KEY | ShiftMask, ActResize, 0},  {XK_space, MOD_KEY, ActLayout, 0},
+};
+typedef struct {
+        unsigned char action;
+        unsigned char arg;
+} KeyAction;
+// [keycode][Shift held] for key events whose state is exactly MOD_KEY or
+// MOD_KEY|ShiftMask
+static KeyAction keyTable[256][2];
+typedef void (*KeyGrab)(unsigned char code, unsigned int modifiers);
+static void keyBindAction(unsigned char code, unsigned int modifiers, unsigned char action,
+                          unsigned char arg, KeyGrab grab) {
+        keyTable[code][(modifiers & ShiftMask) != 0] = (KeyAction){action, arg};
+        grab(code, modifiers);
+}
+// Binds everything sym, the unshifted keysym of code, triggers, and has grab()
+// grab each modifier combination. Callers clear keyTable and their grabs
+// first and then bind every keycode, so keys that appear twice in a layout
+// work from both places.
+static void keyBind(unsigned char code, unsigned long sym, KeyGrab grab) {
+        if (sym == NoSymbol) return;
+        for (unsigned char i = 0; i < sizeof(bindings) / sizeof(bindings[0]); i++) {
+                if (bindings[i].keysym == sym)
+                        keyBindAction(code, bindings[i].modifiers, bindings[i].action,
+                                      bindings[i].arg, grab);
+        }
+        if (sym >= XK_1 && sym < XK_1 + MAX_DESKTOPS) {
+                keyBindAction(code, MOD_KEY, ActDesktop, sym - XK_1, grab);
+                keyBindAction(code, MOD_KEY | ShiftMask, ActMove, sym - XK_1, grab);
+        }
+        for (unsigned char i = 0; i < sizeof(launchers) / sizeof(launchers[0]); i++) {
+                if (launchers[i].keysym == sym) keyBindAction(code, MOD_KEY, ActLaunch, i, grab);
+        }
+}
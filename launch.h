@@ -0,0 +1,64 @@
+// Launcher spawning, shared by main.c, mwm-xcb.c and bench/spawn.c.
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#define LAUNCH_MAX_ARGS 32
+// Splits s in place into argv. Only plain words and single quotes are
+// understood; anything else the shell would interpret makes this return 0 and
+// the command is run through /bin/sh -c instead.
+static _Bool launchParse(char *s, char **argv) {
+        unsigned int argc = 0;
+        char *w           = s;
+        while (*s) {
+                while (*s == ' ' || *s == '\t') s++;
+                if (!*s) break;
+                if (argc == LAUNCH_MAX_ARGS - 1) return 0;
+                argv[argc++] = w;
+                while (*s && *s != ' ' && *s != '\t') {
+                        if (*s == '\'') {
+                                char *end = strchr(s + 1, '\'');
+                                if (!end) return 0;
+                                memmove(w, s + 1, end - s - 1);
+                                w += end - s - 1;
+                                s = end + 1;
+                        } else if (strchr("\"\\$`|&;<>()*?[]{}~#\n", *s) ||
+                                   (*s == '=' && argc == 1)) {
+                                return 0;
+                        } else {
+                                *w++ = *s++;
+                        }
+                }
+                // w may have caught up with s, so read the separator first
+                char sep = *s;
+                *w++     = '\0';
+                if (sep) s++;
+        }
+        argv[argc] = NULL;
+        return argc > 0;
+}
+// Starts argv (or `sh -c command` when argv is empty) in its own session with
+// stdio on /dev/null. A plain fork returns as soon as the child exists;
+// posix_spawn's vfork-style clone would keep mwm suspended until the exec is
+// done, several times longer (see bench/spawn). There is no intermediate
+// process: mwm reaps the child when its signalfd reports SIGCHLD. The child
+// starts with no signals blocked and SIGCHLD and SIGPIPE at their defaults,
+// whatever mwm set up for its signalfd.
+static pid_t launchSpawn(char *const *argv, const char *command) {
+        pid_t pid = fork();
+        if (pid) return pid;
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        setsid();
+        int null = open("/dev/null", O_RDWR);
+        for (int fd = 0; fd <= 2; fd++) dup2(null, fd);
+        if (null > 2) close(null);
+        if (argv[0])
+                execvp(argv[0], argv);
+        else
+                execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+}
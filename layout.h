@@ -0,0 +1,57 @@
+// Window layouts as pure functions of (count, screen size, delta, layout), shared
+// by main.c, mwm-xcb.c and bench/layout.c. Nothing here talks to the X server.
+#define LAYOUT_MIN 100// smallest master width (height for bottom-stack)
+enum { LayoutTile, LayoutMonocle, LayoutGrid, LayoutBottomStack, LayoutLast };
+static const char *const layoutNames[LayoutLast] = {"tile", "monocle", "grid", "bstack"};
+typedef struct {
+        int x, y;
+        unsigned int w, h;
+} Geometry;
+static inline unsigned int layoutMaster(unsigned int size, int delta) {
+        int m = (int)(size >> 1) + delta;
+        if (m < LAYOUT_MIN) m = LAYOUT_MIN;
+        if (m > (int)size - LAYOUT_MIN) m = size - LAYOUT_MIN;
+        return m;
+}
+// Fills out[0..n) for n windows in slot order. The switch keeps the choice a
+// jump table instead of a call through a pointer on every relayout.
+static void layoutApply(unsigned char layout, unsigned short n, unsigned int sw,
+                        unsigned int sh, int delta, Geometry *out) {
+        if (n == 0) return;
+        if (n == 1 || layout == LayoutMonocle) {
+                for (unsigned short i = 0; i < n; i++) out[i] = (Geometry){0, 0, sw, sh};
+                return;
+        }
+        switch (layout) {
+                case LayoutGrid: {
+                        unsigned int cols = 1;
+                        while (cols * cols < n) cols++;
+                        unsigned int rows = (n + cols - 1) / cols;
+                        unsigned int h    = sh / rows;
+                        for (unsigned short i = 0; i < n; i++) {
+                                unsigned int row = i / cols, col = i % cols;
+                                // the last row shares the full width among fewer windows
+                                unsigned int inRow = row == rows - 1 ? n - row * cols : cols;
+                                unsigned int w     = sw / inRow;
+                                out[i] = (Geometry){(int)(col * w), (int)(row * h), w, h};
+                        }
+                        break;
+                }
+                case LayoutBottomStack: {
+                        unsigned int mh = layoutMaster(sh, delta);
+                        unsigned int w  = sw / (n - 1);
+                        out[0]          = (Geometry){0, 0, sw, mh};
+                        for (unsigned short i = 1; i < n; i++)
+                                out[i] = (Geometry){(int)((i - 1) * w), (int)mh, w, sh - mh};
+                        break;
+                }
+                default: {
+                        unsigned int mw = layoutMaster(sw, delta);
+                        unsigned int h  = sh / (n - 1);
+                        out[0]          = (Geometry){0, 0, mw, sh};
+                        for (unsigned short i = 1; i < n; i++)
+                                out[i] = (Geometry){(int)mw, (int)((i - 1) * h), sw - mw, h};
+                        break;
+                }
+        }
+}
@@ -1,46 +1,223 @@
-#include <X11/XF86keysym.h>
-#include <X11/XKBlib.h>
+#define _GNU_SOURCE
+#include <X11/Xatom.h>
 #include <X11/Xlib.h>
-#include <X11/keysym.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/sync.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <sys/select.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
+
+#include "index.h"
+#include "launch.h"
+#include "layout.h"
+#include "stats.h"
+#include "trace.h"
 #define RESIZE_STEP 30
-#define MAX_DESKTOPS 9            // 256 limit
-#define MAX_WINDOWS_PER_DESKTOP 12// 256 limit
+// how long a _NET_WM_SYNC_REQUEST client may take to acknowledge a configure
+// before mwm stops waiting for it
+#define SYNC_TIMEOUT_MS 100
+#define MAX_DESKTOPS 9// 256 limit
+// Client records come from a free list refilled POOL_CHUNK at a time; desktop
+// slot arrays start at DESKTOP_CAPACITY and double when full. Neither shrinks,
+// so once a session reaches its high-water mark no event allocates.
+#define POOL_CHUNK 64
+#define DESKTOP_CAPACITY 16
 #define CURRENT_DESKTOP desktops[currentDesktop]
-#define DESKTOPS desktops
-#define MOD_KEY Mod4Mask
-#ifndef AUDIO_SCRIPT
-#define AUDIO_SCRIPT ""
-#endif
+// every desktop starts in this layout; Mod+space cycles through layoutNames
+#define DEFAULT_LAYOUT LayoutTile
+// _MWM_STATE, the root property a restarting mwm hands its desktops over in:
+// a header of STATE_VERSION, MAX_DESKTOPS and currentDesktop, then per desktop
+// container, focusedIdx, resizeDelta, layout and windowCount, each followed
+// by window, x, y, w, h and WM_STATE of its clients in slot order, and last
+// every handed-over window again in _NET_CLIENT_LIST order
+#define STATE_VERSION 2
+#define STATE_HEADER 3
+#define STATE_DESKTOP 5
+#define STATE_CLIENT 6
+// control socket: concurrent connections and longest accepted command line
+#define CONTROL_CONNS 8
+#define CONTROL_LINE 128
+// ready descriptors handled per epoll_wait()
+#define EPOLL_BATCH 16
+// on-screen display of the audio helper's status lines: core font, padding
+// around the text, and how long it stays up after the last update
+#define OSD_FONT "fixed"
+#define OSD_PAD 12
+#define OSD_MS 1000
+// When AUDIO_HELPER names the audio binary, media keys go to one resident
+// `audio -d` process over a socket instead of running AUDIO_SCRIPT per press.
+// AUDIO_SCRIPT stays the fallback if the helper cannot be started or exits.
+#include "keys.h"
+// WM_PROTOCOLS entries cached per client, refreshed on PropertyNotify
+#define PROTO_DELETE (1 << 0)
+#define PROTO_SYNC (1 << 1)
+// _NET_WM_STATE atoms kept per client besides HIDDEN: every other EWMH state
+// fits, anything beyond is dropped
+#define NET_STATE_MAX 12
+typedef struct Client {
+        Window win;
+        // UnmapNotify events caused by our own reparenting, not by the client
+        unsigned char ignoreUnmaps;
+        unsigned char protocols;
+        unsigned char desktop;
+        unsigned short slot;// position in desktops[desktop].clients
+        // last geometry and stacking sent to the server; w == 0 until tiled once
+        short x, y;
+        unsigned short w, h;
+        _Bool onTop;
+        // WM_STATE last written: WithdrawnState until the first batch after
+        // mapping, then NormalState or IconicState
+        unsigned char wmState;
+        // _NET_WM_STATE as the client set it, minus HIDDEN, and whether HIDDEN
+        // is on the window; netStateWrites counts PropertyNotify events still
+        // due for our own writes, which need no refetch
+        unsigned char netStateLen, netStateWrites;
+        _Bool netHidden;
+        Atom netState[NET_STATE_MAX];
+        // _NET_WM_SYNC_REQUEST: while syncPending, size changes wait for the
+        // client to bump its counter to syncValue, or for SYNC_TIMEOUT_MS
+        _Bool syncPending;
+        XSyncCounter counter;
+        XSyncAlarm alarm;
+        unsigned long long syncValue;
+        unsigned long long syncSentMs;
+        struct Client *next;// free list link
+} Client;
+// Clients are reparented into one container per desktop. Only the current
+// desktop's container is mapped, so a switch is one map plus one unmap no
+// matter how many windows either desktop holds.
 typedef struct {
-        KeySym keysym;
-        const char *command;
-} AppLauncher;
-static AppLauncher launchers[6] = {{XK_Return, "st"},
-                                   {XK_p,
-                                    "dmenu_run -m '0' -nb '#000000' -nf '#ffffff' -sb "
-                                    "'#ffffff' -sf '#000000'"},
-                                   {XF86XK_AudioRaiseVolume, AUDIO_SCRIPT " +"},
-                                   {XF86XK_AudioLowerVolume, AUDIO_SCRIPT " -"},
-                                   {XF86XK_AudioMicMute, AUDIO_SCRIPT " mic"},
-                                   {XF86XK_AudioMute, AUDIO_SCRIPT " aud"}};
-typedef struct {
-        Window windows[MAX_WINDOWS_PER_DESKTOP];
-        _Bool isMapped[MAX_WINDOWS_PER_DESKTOP];
-        unsigned char windowCount;
-        unsigned char focusedIdx;
+        Window container;
+        Client **clients;
+        unsigned short windowCount;
+        unsigned short capacity;
+        unsigned short focusedIdx;
+        unsigned char layout;
 } Desktop;
+// Everything run() waits on is a Source registered with epoll; ready() runs
+// when its descriptor is readable. New inputs only need a Source and an
+// addSource() call, not changes to the loop.
+typedef struct Source {
+        int fd;
+        void (*ready)(struct Source *src);
+} Source;
+// One connection to the control socket with its partial command line.
+typedef struct {
+        Source src;// first, so readControl() can cast back
+        unsigned char len;
+        _Bool overlong;// the line in progress is being skipped
+        char buf[CONTROL_LINE];
+} ControlConn;
+// What handleUnmapNotify() looks for in the event queue.
+typedef struct {
+        Window win;
+        Bool remapped, destroyed;
+} PendingDestroy;
+// Timed work shares one timerfd; each entry is an absolute nowMs() deadline,
+// 0 while unset.
+enum { TimerSync, TimerOsd, TimerLast };
 static Display *dpy;
 #define ARRAY_LEN(arr) (sizeof(arr) / sizeof((arr)[0]))
-static _Bool IsSwitching = False;
+// interned once in setup() with a single XInternAtoms round-trip; the EWMH
+// atoms from NetSupported on are advertised in _NET_SUPPORTED
+enum {
+        WMProtocols,
+        WMDelete,
+        NetWMSyncRequestCounter,
+        UTF8String,
+        MWMState,
+        WMState,
+        NetSupported,
+        NetSupportingWMCheck,
+        NetWMName,
+        NetNumberOfDesktops,
+        NetCurrentDesktop,
+        NetClientList,
+        NetActiveWindow,
+        NetWMState,
+        NetWMStateHidden,
+        NetWMSyncRequest,
+        AtomLast
+};
+static char *atomNames[AtomLast] = {"WM_PROTOCOLS",
+                                    "WM_DELETE_WINDOW",
+                                    "_NET_WM_SYNC_REQUEST_COUNTER",
+                                    "UTF8_STRING",
+                                    "_MWM_STATE",
+                                    "WM_STATE",
+                                    "_NET_SUPPORTED",
+                                    "_NET_SUPPORTING_WM_CHECK",
+                                    "_NET_WM_NAME",
+                                    "_NET_NUMBER_OF_DESKTOPS",
+                                    "_NET_CURRENT_DESKTOP",
+                                    "_NET_CLIENT_LIST",
+                                    "_NET_ACTIVE_WINDOW",
+                                    "_NET_WM_STATE",
+                                    "_NET_WM_STATE_HIDDEN",
+                                    "_NET_WM_SYNC_REQUEST"};
+static Atom atoms[AtomLast];
+// launchers[] split into argv once in setup(); argv[0] == NULL means the
+// command needs /bin/sh -c
+static char *launcherArgv[ARRAY_LEN(launchers)][LAUNCH_MAX_ARGS];
 static Desktop desktops[MAX_DESKTOPS];
 static Window root;
-static unsigned char currentDesktop  = 0;
-static volatile sig_atomic_t running = 1;
+static Client *freeClients = NULL;
+// windows for every event, sync alarms for alarm notifications
+static XidIndex windowIndex, alarmIndex;
+static unsigned char currentDesktop        = 0;
+static _Bool running    = True;
+static _Bool restarting = False;
+// X errors are fatal only while setup() checks for another window manager
+static _Bool startingUp = True;
+// False when the containers were taken over from the mwm that exec'ed us and
+// belong to its retained client instead of to this connection
+static _Bool ownContainers = True;
+// tileWindows() bookkeeping, printed to stderr on SIGUSR1
+static unsigned long configuresSent = 0, configuresSkipped = 0, configuresDeferred = 0;
+static _Bool haveSync = False;
+static int syncEventBase;
+static unsigned int syncPendingCount = 0;
+static int epollFd;
+static unsigned long long timerDeadline[TimerLast];
+static _Bool timersDirty = False;
+static void readX(Source *src);
+static void readSignals(Source *src);
+static void readTimers(Source *src);
+static Source xSource      = {-1, readX};
+static Source signalSource = {-1, readSignals};
+static Source timerSource  = {-1, readTimers};
+#ifdef AUDIO_HELPER
+static void readAudioReplies(Source *src);
+static Source audioSource = {-1, readAudioReplies};
+// One window, created at startup and updated in place, so a held key moves
+// one popup instead of starting a notifier per repeat. osdGC is None when
+// the font could not be loaded.
+static Window osd;
+static GC osdGC;
+static XFontStruct *osdFont;
+static char osdText[32];
+static unsigned char osdLen = 0;
+static _Bool osdShown       = False;
+#endif
+static void acceptControl(Source *src);
+static void readControl(Source *src);
+static Source controlSource = {-1, acceptControl};
+static ControlConn controlConns[CONTROL_CONNS];
+static struct sockaddr_un controlAddr;
 
 // 'resizeDelta' stores pixel offsets in tileWindows.
 // 'char' (-128 to 127) is too small to hold needed values,
@@ -50,6 +227,25 @@ static short resizeDelta[MAX_DESKTOPS] = {0};
 // (0–255) but safe in unsigned short
 static unsigned short screen_width, screen_height;
 static _Bool need_flush = False;
+// Handlers only set this; run() relayouts the current desktop once the event
+// queue is drained, so a burst of N events costs one tileWindows() and one flush.
+static _Bool layoutDirty = False;
+// asks run() to rebuild keyTable after MappingNotify
+static _Bool keysDirty = False;
+// EWMH state as last written to the root window. publishState() compares
+// against it once per event batch, so pagers see one PropertyNotify per real
+// change. clientList is _NET_CLIENT_LIST in mapping order.
+static Window wmCheck;
+static Window *clientList;
+static unsigned int clientListLen = 0, clientListCap = 0;
+static _Bool clientListDirty      = False;
+static long publishedDesktop      = -1;
+static Window publishedActive     = ~0UL;
+// some client may be on the wrong side of visible/hidden in its WM_STATE
+static _Bool windowStatesDirty = False;
+// tileWindows() output, grown with the largest desktop and never shrunk
+static Geometry *layoutBuf;
+static unsigned short layoutBufLen = 0;
 
 static void setup(void);
 static void run(void);
@@ -58,38 +254,144 @@ static void handleKeyPress(XEvent *e);
 static void handleMapRequest(Window win);
 static void handleUnmapNotify(Window win);
 static void handleDestroyNotify(Window win);
+static void handlePropertyNotify(XPropertyEvent *ev);
+static unsigned char fetchProtocols(Window win);
+static void fetchSyncCounter(Client *c);
+static void handleSyncAlarm(XSyncAlarmNotifyEvent *ev);
+static void expireSyncRequests(void);
 inline static void focusWindow(Window w);
 static void tileWindows(void);
 static void switchDesktop(unsigned char desktop);
 static void moveWindowToDesktop(Window win, unsigned char desktop);
+static Client *clientLookup(Window win);
+static Client *manageClient(Window win, unsigned char desktop, _Bool reparent);
+static Client *adoptClient(Window win, unsigned char desktop, _Bool reparent);
+static void unmanageClient(Client *c);
+static void attachClient(Client *c, unsigned char desktop, _Bool reparent);
+static void detachClient(Client *c);
 static void grabKeys(void);
-static void sigHandler(Bool);
+static void dumpCounters(void);
+static void startControlSocket(void);
+static void addSource(Source *src);
+static void removeSource(Source *src);
+static void setTimer(unsigned char timer, unsigned int ms);
+static unsigned long long nowMs(void);
+static void resizeMaster(int delta);
+static void setLayout(unsigned char layout);
+static void setupEwmh(void);
+static void publishState(void);
+static _Bool restoreState(void);
+static void adoptWindows(void);
+static void restart(char *argv[]);
+#ifdef AUDIO_HELPER
+static void startAudioHelper(void);
+static _Bool sendAudioCommand(KeySym keysym);
+static void createOsd(void);
+static void showOsd(const char *text, unsigned int len);
+static void drawOsd(void);
+static void hideOsd(void);
+#endif
 // Must return int because XSetErrorHandler requires this signature
 static int xerror(Display *, XErrorEvent *);
 static void killFocusedWindow(void);
 inline static void focusCycleWindow(_Bool);// 1 bit
-static void removeWindowFromDesktop(Window win, Desktop *d);
 inline static void die(void);
-int main(void) {
-        signal(SIGCHLD, SIG_IGN);
-        signal(SIGTERM, sigHandler);
-        signal(SIGINT, sigHandler);
+int main(int argc, char *argv[]) {
+        (void)argc;
         setup();
         run();
+        if (restarting) restart(argv);
         cleanup();
+        return EXIT_SUCCESS;
 }
 inline static void die(void) {
         __attribute__((unused)) char _ = write(2, "mwm:error\n", 10);
         _exit(1);
 }
-static void sigHandler(Bool sig) {
-        (void)sig;
-        running = 0;
+static void addSource(Source *src) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = src};
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, src->fd, &ev) == -1) die();
+}
+static void removeSource(Source *src) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, src->fd, NULL);
+        close(src->fd);
+        src->fd = -1;
+}
+// Events are read by XPending() at the top of run(); waking up is enough.
+static void readX(Source *src) { (void)src; }
+// TERM and INT quit, HUP restarts, USR1 dumps the counters and CHLD reaps
+// launched programs and the audio helper.
+static void readSignals(Source *src) {
+        struct signalfd_siginfo si;
+        while (read(src->fd, &si, sizeof(si)) == sizeof(si)) {
+                switch (si.ssi_signo) {
+                        case SIGHUP:
+                                restarting = True;
+                                running    = False;
+                                break;
+                        case SIGUSR1:
+                                dumpCounters();
+                                break;
+                        case SIGCHLD:
+                                // one signal may stand for several exits
+                                while (waitpid(-1, NULL, WNOHANG) > 0);
+                                break;
+                        default:
+                                running = False;
+                                break;
+                }
+        }
+}
+static void setTimer(unsigned char timer, unsigned int ms) {
+        timerDeadline[timer] = nowMs() + ms;
+        timersDirty          = True;
+}
+// Points the timerfd at the earliest deadline, or disarms it.
+static void armTimers(void) {
+        unsigned long long next = 0;
+        for (unsigned char t = 0; t < TimerLast; t++) {
+                if (timerDeadline[t] && (!next || timerDeadline[t] < next)) next = timerDeadline[t];
+        }
+        struct itimerspec its = {0};
+        its.it_value.tv_sec   = next / 1000;
+        its.it_value.tv_nsec  = next % 1000 * 1000000;
+        timerfd_settime(timerSource.fd, TFD_TIMER_ABSTIME, &its, NULL);
+        timersDirty = False;
+}
+// Runs timer t, whose deadline has passed.
+static void fireTimer(unsigned char t) {
+        TRACE_TIMER(t);
+        timerDeadline[t] = 0;
+        timersDirty      = True;
+        switch (t) {
+                case TimerSync:
+                        expireSyncRequests();
+                        break;
+                case TimerOsd:
+#ifdef AUDIO_HELPER
+                        hideOsd();
+#endif
+                        break;
+        }
+}
+static void readTimers(Source *src) {
+        unsigned long long expirations;
+        if (read(src->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+        unsigned long long now = nowMs();
+        for (unsigned char t = 0; t < TimerLast; t++) {
+                if (timerDeadline[t] && timerDeadline[t] <= now) fireTimer(t);
+        }
+}
+static void dumpCounters(void) {
+        char buf[128];
+        int len = snprintf(buf, sizeof(buf),
+                           "mwm:configures sent %lu skipped %lu deferred %lu\n", configuresSent,
+                           configuresSkipped, configuresDeferred);
+        __attribute__((unused)) ssize_t _ = write(2, buf, len);
+        STATS_DUMP();
 }
 static int xerror(Display *dpy, XErrorEvent *ee) {
-        static _Bool startup = True;
-        if (startup) {
-                startup = False;
+        if (startingUp) {
                 die();
                 return -1;
         }
@@ -99,321 +401,1276 @@ static int xerror(Display *dpy, XErrorEvent *ee) {
 }
 static void setup(void) {
         if (!getenv("DISPLAY")) die();
+        STATS_INIT();
+        // signals are only ever read from the signalfd; an inherited SIG_IGN
+        // for SIGCHLD would make the kernel drop it
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTERM);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGHUP);
+        sigaddset(&mask, SIGUSR1);
+        sigaddset(&mask, SIGCHLD);
+        signal(SIGCHLD, SIG_DFL);
+        sigprocmask(SIG_BLOCK, &mask, NULL);
+        epollFd             = epoll_create1(EPOLL_CLOEXEC);
+        signalSource.fd     = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        timerSource.fd      = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (epollFd == -1 || signalSource.fd == -1 || timerSource.fd == -1) die();
+        addSource(&signalSource);
+        addSource(&timerSource);
+        if (!indexInit(&windowIndex) || !indexInit(&alarmIndex)) die();
+        for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
+                desktops[d].clients = malloc(DESKTOP_CAPACITY * sizeof(Client *));
+                if (!desktops[d].clients) die();
+                desktops[d].capacity = DESKTOP_CAPACITY;
+                desktops[d].layout   = DEFAULT_LAYOUT;
+        }
         dpy = XOpenDisplay(NULL);
         if (!dpy) die();
-        root = DefaultRootWindow(dpy);
+        root        = DefaultRootWindow(dpy);
+        xSource.fd  = ConnectionNumber(dpy);
+        addSource(&xSource);
         XWindowAttributes attr;
+        STATS_ROUNDTRIP();
         if (!XGetWindowAttributes(dpy, root, &attr)) die();
         screen_width  = attr.width;
         screen_height = attr.height;
         XSetErrorHandler(xerror);
         XSelectInput(dpy, root,
                      SubstructureRedirectMask | SubstructureNotifyMask | StructureNotifyMask);
+        // BadAccess here means another window manager is running
+        STATS_ROUNDTRIP();
+        XSync(dpy, False);
+        startingUp = False;
+        STATS_ROUNDTRIP();
+        if (!XInternAtoms(dpy, atomNames, AtomLast, False, atoms)) die();
+        int syncErrorBase, syncMajor, syncMinor;
+        // QueryExtension and the version handshake are one reply each
+        STATS_ROUNDTRIP();
+        haveSync = XSyncQueryExtension(dpy, &syncEventBase, &syncErrorBase);
+        if (haveSync) {
+                STATS_ROUNDTRIP();
+                haveSync = XSyncInitialize(dpy, &syncMajor, &syncMinor);
+        }
+        if (!restoreState()) {
+                XSetWindowAttributes wa;
+                wa.override_redirect = True;
+                wa.background_pixmap = ParentRelative;
+                wa.event_mask        = SubstructureRedirectMask | SubstructureNotifyMask;
+                for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
+                        desktops[d].container = XCreateWindow(
+                            dpy, root, 0, 0, screen_width, screen_height, 0, CopyFromParent,
+                            InputOutput, CopyFromParent,
+                            CWOverrideRedirect | CWBackPixmap | CWEventMask, &wa);
+                }
+        }
+        XMapWindow(dpy, CURRENT_DESKTOP.container);
+        adoptWindows();
         Cursor cursor = XCreateFontCursor(dpy, 68);
         if (cursor == None) die();
         XDefineCursor(dpy, root, cursor);
+        setupEwmh();
+        for (unsigned char i = 0; i < ARRAY_LEN(launchers); i++) {
+                char *buf = strdup(launchers[i].command);
+                if (!buf || !launchParse(buf, launcherArgv[i])) {
+                        free(buf);
+                        launcherArgv[i][0] = NULL;
+                }
+        }
         grabKeys();
-        XSync(dpy, False);
+#ifdef AUDIO_HELPER
+        createOsd();
+        startAudioHelper();
+        TRACE_INIT(screen_width, screen_height, audioSource.fd >= 0);
+#else
+        TRACE_INIT(screen_width, screen_height, False);
+#endif
+        startControlSocket();
 }
-static void grabKey(KeySym keysym, unsigned int modifiers, Bool with_shift) {
-        KeyCode code = XKeysymToKeycode(dpy, keysym);
-        if (!code) return;
+static void grabKey(unsigned char code, unsigned int modifiers) {
         XGrabKey(dpy, code, modifiers, root, True, GrabModeAsync, GrabModeAsync);
-        if (with_shift) {
-                XGrabKey(dpy, code, modifiers | ShiftMask, root, True, GrabModeAsync,
-                         GrabModeAsync);
-        }
 }
+// Fills keyTable and the grabs from one XGetKeyboardMapping. Runs again after
+// each keyboard mapping change.
 static void grabKeys(void) {
-        for (unsigned char i = 0; i < MAX_DESKTOPS; ++i) {
-                grabKey(XK_1 + i, MOD_KEY, True);
+        int min, max, perCode;
+        // the keycode range comes from the connection setup, not a request
+        XDisplayKeycodes(dpy, &min, &max);
+        STATS_ROUNDTRIP();
+        KeySym *syms = XGetKeyboardMapping(dpy, min, max - min + 1, &perCode);
+        if (!syms) return;
+        memset(keyTable, 0, sizeof(keyTable));
+        XUngrabKey(dpy, AnyKey, AnyModifier, root);
+        for (int code = min; code <= max; code++) {
+                KeySym sym = syms[(code - min) * perCode];
+                TRACE_KEYSYM(code, sym);
+                keyBind(code, sym, grabKey);
         }
-        static const KeySym wmKeys[] = {XK_q, XK_j, XK_k, XK_h, XK_l};
-        for (unsigned char i = 0; i < ARRAY_LEN(wmKeys); ++i) {
-                grabKey(wmKeys[i], MOD_KEY, True);
+        XFree(syms);
+}
+// Everything a batch of events left dirty, applied once the queue is drained.
+static void finishBatch(void) {
+        if (keysDirty) {
+                grabKeys();
+                keysDirty  = False;
+                need_flush = True;
         }
-        for (unsigned char i = 0; i < ARRAY_LEN(launchers); ++i) {
-                grabKey(launchers[i].keysym, MOD_KEY, False);
+        if (layoutDirty) {
+                tileWindows();
+                layoutDirty = False;
+                need_flush  = True;
+        }
+        publishState();
+        if (need_flush) {
+                XFlush(dpy);
+                STATS_FLUSH();
+                need_flush = False;
+        }
+        TRACE_BATCH();
+}
+static void handleEvent(XEvent *e) {
+        STATS_EVENT(e->type);
+        TRACE_EVENT(e);
+        switch (e->type) {
+                case KeyPress:
+                        handleKeyPress(e);
+                        break;
+                case MapRequest:
+                        handleMapRequest(e->xmaprequest.window);
+                        break;
+                case UnmapNotify:
+                        handleUnmapNotify(e->xunmap.window);
+                        break;
+                case DestroyNotify:
+                        handleDestroyNotify(e->xdestroywindow.window);
+                        break;
+                case PropertyNotify:
+                        handlePropertyNotify(&e->xproperty);
+                        break;
+                case MappingNotify:
+                        // setxkbmap and friends move keysyms to other
+                        // keycodes; rebuild once per batch
+                        XRefreshKeyboardMapping(&e->xmapping);
+                        if (e->xmapping.request == MappingKeyboard ||
+                            e->xmapping.request == MappingModifier)
+                                keysDirty = True;
+                        break;
+                case ConfigureNotify:
+                        if (e->xconfigure.window != root) break;
+                        screen_width  = e->xconfigure.width;
+                        screen_height = e->xconfigure.height;
+                        for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
+                                XResizeWindow(dpy, desktops[d].container, screen_width,
+                                              screen_height);
+                        }
+                        layoutDirty = True;
+                        break;
+#ifdef AUDIO_HELPER
+                case Expose:
+                        if (e->xexpose.window == osd && e->xexpose.count == 0) drawOsd();
+                        break;
+#endif
+                default:
+                        if (haveSync && e->type == syncEventBase + XSyncAlarmNotify)
+                                handleSyncAlarm((XSyncAlarmNotifyEvent *)e);
+                        break;
         }
 }
 static void run(void) {
         XEvent e;
-        fd_set fds;
-        int xfd = ConnectionNumber(dpy);
+        struct epoll_event ready[EPOLL_BATCH];
         while (running) {
                 while (XPending(dpy)) {
                         XNextEvent(dpy, &e);
-                        switch (e.type) {
-                                case KeyPress:
-                                        handleKeyPress(&e);
-                                        break;
-                                case MapRequest:
-                                        handleMapRequest(e.xmaprequest.window);
-                                        break;
-                                case UnmapNotify:
-                                        handleUnmapNotify(e.xunmap.window);
-                                        break;
-                                case DestroyNotify:
-                                        handleDestroyNotify(e.xdestroywindow.window);
-                                        break;
-                                case ConfigureNotify:
-                                        if (e.xconfigure.window != root) break;
-                                        screen_width  = e.xconfigure.width;
-                                        screen_height = e.xconfigure.height;
-                                        tileWindows();
-                                        break;
-                                default:
-                                        break;
-                        }
+                        handleEvent(&e);
                 }
-                if (need_flush) {
-                        XFlush(dpy);
-                        need_flush = False;
-                }
-                FD_ZERO(&fds);
-                FD_SET(xfd, &fds);
-                if (select(xfd + 1, &fds, NULL, NULL, NULL) == -1) {
+                finishBatch();
+                if (timersDirty) armTimers();
+                // the keymap reply grabKeys() waits for can pull events into
+                // Xlib's queue, where epoll would not see them
+                if (XEventsQueued(dpy, QueuedAlready)) continue;
+                int n = epoll_wait(epollFd, ready, EPOLL_BATCH, -1);
+                if (n == -1) {
                         if (errno == EINTR)
                                 continue;
                         else
                                 break;
                 }
+                // sources only mark work dirty, so everything that arrived here
+                // is applied by one tileWindows() and one flush at the loop top
+                for (int i = 0; i < n; i++) {
+                        Source *src = ready[i].data.ptr;
+                        src->ready(src);
+                }
+        }
+}
+static void setupEwmh(void) {
+        wmCheck = XCreateSimpleWindow(dpy, root, -1, -1, 1, 1, 0, 0, 0);
+        XChangeProperty(dpy, wmCheck, atoms[NetSupportingWMCheck], XA_WINDOW, 32,
+                        PropModeReplace, (unsigned char *)&wmCheck, 1);
+        XChangeProperty(dpy, wmCheck, atoms[NetWMName], atoms[UTF8String], 8, PropModeReplace,
+                        (unsigned char *)"mwm", 3);
+        XChangeProperty(dpy, root, atoms[NetSupportingWMCheck], XA_WINDOW, 32, PropModeReplace,
+                        (unsigned char *)&wmCheck, 1);
+        XChangeProperty(dpy, root, atoms[NetSupported], XA_ATOM, 32, PropModeReplace,
+                        (unsigned char *)&atoms[NetSupported], AtomLast - NetSupported);
+        long count = MAX_DESKTOPS;
+        XChangeProperty(dpy, root, atoms[NetNumberOfDesktops], XA_CARDINAL, 32,
+                        PropModeReplace, (unsigned char *)&count, 1);
+        XDeleteProperty(dpy, root, atoms[NetClientList]);
+}
+static void writeWMState(Window win, long state) {
+        long data[2] = {state, None};
+        XChangeProperty(dpy, win, atoms[WMState], atoms[WMState], 32, PropModeReplace,
+                        (unsigned char *)data, 2);
+}
+// Reads _NET_WM_STATE into states without HIDDEN and returns how many are
+// left; hidden tells whether HIDDEN was there.
+static unsigned char fetchNetState(Window win, Atom *states, _Bool *hidden) {
+        Atom type;
+        int format;
+        unsigned long count, after;
+        unsigned char *data = NULL, n = 0;
+        *hidden             = False;
+        STATS_ROUNDTRIP();
+        if (XGetWindowProperty(dpy, win, atoms[NetWMState], 0, NET_STATE_MAX + 1, False, XA_ATOM,
+                               &type, &format, &count, &after, &data) != Success)
+                return 0;
+        for (unsigned long i = 0; type == XA_ATOM && format == 32 && i < count; i++) {
+                Atom a = ((Atom *)data)[i];
+                if (a == atoms[NetWMStateHidden])
+                        *hidden = True;
+                else if (n < NET_STATE_MAX)
+                        states[n++] = a;
+        }
+        if (data) XFree(data);
+        return n;
+}
+static void writeNetState(Window win, const Atom *states, unsigned char n, _Bool hidden) {
+        Atom merged[NET_STATE_MAX + 1];
+        memcpy(merged, states, n * sizeof(Atom));
+        if (hidden) merged[n++] = atoms[NetWMStateHidden];
+        XChangeProperty(dpy, win, atoms[NetWMState], XA_ATOM, 32, PropModeReplace,
+                        (unsigned char *)merged, n);
+}
+// ICCCM WM_STATE, and _NET_WM_STATE_HIDDEN exactly while it is IconicState,
+// so clients on hidden desktops can stop animating. Every other
+// _NET_WM_STATE comes from the cached copy; nothing is read from the server.
+static void setWindowState(Client *c, unsigned char state) {
+        writeWMState(c->win, state);
+        c->wmState = state;
+        if (c->netHidden == (state == IconicState)) return;
+        c->netHidden = state == IconicState;
+        writeNetState(c->win, c->netState, c->netStateLen, c->netHidden);
+        c->netStateWrites++;
+}
+// Writes the root properties whose value differs from what was last written,
+// and the window states of clients whose desktop became visible or hidden.
+static void publishState(void) {
+        if (publishedDesktop != currentDesktop) {
+                publishedDesktop = currentDesktop;
+                XChangeProperty(dpy, root, atoms[NetCurrentDesktop], XA_CARDINAL, 32,
+                                PropModeReplace, (unsigned char *)&publishedDesktop, 1);
+                need_flush = True;
+        }
+        Window active = CURRENT_DESKTOP.windowCount
+                            ? CURRENT_DESKTOP.clients[CURRENT_DESKTOP.focusedIdx]->win
+                            : None;
+        if (publishedActive != active) {
+                publishedActive = active;
+                XChangeProperty(dpy, root, atoms[NetActiveWindow], XA_WINDOW, 32,
+                                PropModeReplace, (unsigned char *)&publishedActive, 1);
+                need_flush = True;
+        }
+        if (clientListDirty) {
+                clientListDirty = False;
+                XChangeProperty(dpy, root, atoms[NetClientList], XA_WINDOW, 32, PropModeReplace,
+                                (unsigned char *)clientList, clientListLen);
+                need_flush = True;
+        }
+        if (!windowStatesDirty) return;
+        windowStatesDirty = False;
+        for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
+                unsigned char state = d == currentDesktop ? NormalState : IconicState;
+                for (unsigned short i = 0; i < desktops[d].windowCount; i++) {
+                        Client *c = desktops[d].clients[i];
+                        if (c->wmState == state) continue;
+                        setWindowState(c, state);
+                        need_flush = True;
+                }
+        }
+}
+// Takes over the desktops a restarting mwm described in _MWM_STATE. Its
+// containers and the windows in them are used as they are, so nothing is
+// reparented or remapped and the cached geometry makes the first relayout a
+// no-op. Returns False when there is no usable state.
+static _Bool restoreState(void) {
+        Atom type;
+        int format;
+        unsigned long count, after;
+        unsigned char *data = NULL;
+        STATS_ROUNDTRIP();
+        if (XGetWindowProperty(dpy, root, atoms[MWMState], 0, 0x7fffffff, True, XA_CARDINAL,
+                               &type, &format, &count, &after, &data) != Success)
+                return False;
+        long *v = (long *)data;
+        Window rootRet, parent, *top = NULL;
+        unsigned int topCount = 0;
+        _Bool valid = data && type == XA_CARDINAL && format == 32 && count >= STATE_HEADER &&
+                      v[0] == STATE_VERSION && v[1] == MAX_DESKTOPS && v[2] >= 0 &&
+                      v[2] < MAX_DESKTOPS;
+        if (valid) {
+                STATS_ROUNDTRIP();
+                valid = XQueryTree(dpy, root, &rootRet, &parent, &top, &topCount);
+        }
+        // every container must still exist and the lengths must add up
+        unsigned long i = STATE_HEADER, clients = 0;
+        for (unsigned char d = 0; valid && d < MAX_DESKTOPS; d++) {
+                valid = i + STATE_DESKTOP <= count && v[i + 4] >= 0 && v[i + 4] <= (long)count;
+                unsigned int t = 0;
+                while (valid && t < topCount && top[t] != (Window)v[i]) t++;
+                valid = valid && t < topCount;
+                if (!valid) break;
+                clients += v[i + 4];
+                i += STATE_DESKTOP + v[i + 4] * STATE_CLIENT;
+        }
+        if (top) XFree(top);
+        if (!valid || i + clients != count) {
+                if (data) XFree(data);
+                return False;
+        }
+        currentDesktop = v[2];
+        i              = STATE_HEADER;
+        for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
+                Desktop *dk     = &desktops[d];
+                dk->container   = v[i];
+                resizeDelta[d]  = v[i + 2];
+                dk->layout      = DEFAULT_LAYOUT;
+                long focused    = v[i + 1];
+                long handedOver = v[i + 4];
+                if (v[i + 3] >= 0 && v[i + 3] < LayoutLast) dk->layout = v[i + 3];
+                i += STATE_DESKTOP;
+                XSelectInput(dpy, dk->container, SubstructureRedirectMask | SubstructureNotifyMask);
+                XResizeWindow(dpy, dk->container, screen_width, screen_height);
+                Window *children = NULL;
+                unsigned int n   = 0;
+                STATS_ROUNDTRIP();
+                XQueryTree(dpy, dk->container, &rootRet, &parent, &children, &n);
+                // windows destroyed during the exec are no longer children
+                for (long k = 0; k < handedOver; k++, i += STATE_CLIENT) {
+                        XWindowAttributes wa;
+                        unsigned int j = 0;
+                        while (j < n && children[j] != (Window)v[i]) j++;
+                        if (j == n) continue;
+                        STATS_ROUNDTRIP();
+                        if (!XGetWindowAttributes(dpy, v[i], &wa)) continue;
+                        // withdrawn during the exec: hand it back as
+                        // handleUnmapNotify() would have
+                        if (wa.map_state == IsUnmapped) {
+                                if (v[i + 5] == IconicState) {
+                                        Atom states[NET_STATE_MAX];
+                                        _Bool hidden;
+                                        unsigned char len = fetchNetState(v[i], states, &hidden);
+                                        writeNetState(v[i], states, len, False);
+                                }
+                                writeWMState(v[i], WithdrawnState);
+                                XReparentWindow(dpy, v[i], root, 0, 0);
+                                XRemoveFromSaveSet(dpy, v[i]);
+                                continue;
+                        }
+                        Client *c = adoptClient(v[i], d, False);
+                        c->x      = v[i + 1];
+                        c->y      = v[i + 2];
+                        c->w      = v[i + 3];
+                        c->h      = v[i + 4];
+                        // what the window already carries need not be written again
+                        if (v[i + 5] == NormalState || v[i + 5] == IconicState)
+                                c->wmState = v[i + 5];
+                }
+                // children are bottom to top; ones not handed over mapped while
+                // no window manager was listening
+                for (unsigned int j = 0; j < n; j++) {
+                        XWindowAttributes wa;
+                        if (clientLookup(children[j])) continue;
+                        STATS_ROUNDTRIP();
+                        if (!XGetWindowAttributes(dpy, children[j], &wa) || wa.override_redirect ||
+                            wa.map_state == IsUnmapped)
+                                continue;
+                        adoptClient(children[j], d, False);
+                }
+                for (unsigned short k = 0; k < dk->windowCount; k++) dk->clients[k]->onTop = False;
+                for (unsigned int j = n; j-- > 0;) {
+                        Client *c = clientLookup(children[j]);
+                        if (!c) continue;
+                        c->onTop = True;
+                        break;
+                }
+                if (children) XFree(children);
+                if (focused >= 0 && focused < dk->windowCount) dk->focusedIdx = focused;
         }
+        // restore the mapping order of _NET_CLIENT_LIST; windows adopted only
+        // now mapped last and stay behind the handed-over ones
+        for (unsigned int kept = 0; i < count; i++) {
+                unsigned int j = kept;
+                while (j < clientListLen && clientList[j] != (Window)v[i]) j++;
+                if (j == clientListLen) continue;
+                memmove(&clientList[kept + 1], &clientList[kept], (j - kept) * sizeof(Window));
+                clientList[kept++] = v[i];
+        }
+        XFree(data);
+        ownContainers = False;
+        layoutDirty   = True;
+        if (CURRENT_DESKTOP.windowCount)
+                focusWindow(CURRENT_DESKTOP.clients[CURRENT_DESKTOP.focusedIdx]->win);
+        return True;
+}
+// Manages top-level windows that are already mapped: every window when mwm
+// starts in a running session, or whatever mapped on the root during a restart.
+static void adoptWindows(void) {
+        Window rootRet, parent, *top = NULL;
+        unsigned int n = 0;
+        STATS_ROUNDTRIP();
+        if (!XQueryTree(dpy, root, &rootRet, &parent, &top, &n)) return;
+        for (unsigned int i = 0; i < n; i++) {
+                XWindowAttributes wa;
+                STATS_ROUNDTRIP();
+                // containers are override-redirect, so they are skipped too
+                if (!XGetWindowAttributes(dpy, top[i], &wa) || wa.override_redirect ||
+                    wa.map_state != IsViewable)
+                        continue;
+                Client *c = adoptClient(top[i], currentDesktop, True);
+                // reparenting a mapped window unmaps it first
+                c->ignoreUnmaps++;
+                CURRENT_DESKTOP.focusedIdx = c->slot;
+                focusWindow(top[i]);
+                layoutDirty = True;
+        }
+        if (top) XFree(top);
+}
+// Re-execs mwm without tearing the session down: the desktops go to
+// _MWM_STATE, and everything the next process has to claim is released first.
+static void restart(char *argv[]) {
+        unsigned long n =
+            STATE_HEADER + MAX_DESKTOPS * STATE_DESKTOP + clientListLen * (STATE_CLIENT + 1);
+        long *v = malloc(n * sizeof(long));
+        if (!v) die();
+        unsigned long i = 0;
+        v[i++]          = STATE_VERSION;
+        v[i++]          = MAX_DESKTOPS;
+        v[i++]          = currentDesktop;
+        XUngrabKey(dpy, AnyKey, AnyModifier, root);
+        XSelectInput(dpy, root, NoEventMask);
+        for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
+                Desktop *dk = &desktops[d];
+                // an owner's event mask outlives the connection under
+                // RetainPermanent and would lock out SubstructureRedirect
+                XSelectInput(dpy, dk->container, NoEventMask);
+                v[i++] = dk->container;
+                v[i++] = dk->focusedIdx;
+                v[i++] = resizeDelta[d];
+                v[i++] = dk->layout;
+                v[i++] = dk->windowCount;
+                for (unsigned short k = 0; k < dk->windowCount; k++) {
+                        Client *c = dk->clients[k];
+                        if (c->alarm != None) XSyncDestroyAlarm(dpy, c->alarm);
+                        XSelectInput(dpy, c->win, NoEventMask);
+                        // so closing this connection cannot touch it; the next
+                        // mwm adds it to its own save-set
+                        XRemoveFromSaveSet(dpy, c->win);
+                        v[i++] = c->win;
+                        v[i++] = c->x;
+                        v[i++] = c->y;
+                        v[i++] = c->w;
+                        v[i++] = c->h;
+                        v[i++] = c->wmState;
+                }
+        }
+        for (unsigned int k = 0; k < clientListLen; k++) v[i++] = clientList[k];
+        XChangeProperty(dpy, root, atoms[MWMState], XA_CARDINAL, 32, PropModeReplace,
+                        (unsigned char *)v, n);
+        free(v);
+        XDestroyWindow(dpy, wmCheck);
+#ifdef AUDIO_HELPER
+        // RetainPermanent would keep these around in the server for good
+        if (osdGC) {
+                XFreeGC(dpy, osdGC);
+                XFreeFont(dpy, osdFont);
+                XDestroyWindow(dpy, osd);
+        }
+#endif
+        // containers we created would be destroyed with the connection
+        if (ownContainers) XSetCloseDownMode(dpy, RetainPermanent);
+        XCloseDisplay(dpy);
+        execvp(argv[0], argv);
+        die();
 }
 static void killFocusedWindow(void) {
         if (CURRENT_DESKTOP.windowCount == 0) return;
         if (CURRENT_DESKTOP.focusedIdx >= CURRENT_DESKTOP.windowCount) return;
-        Window win = CURRENT_DESKTOP.windows[CURRENT_DESKTOP.focusedIdx];
+        Client *c  = CURRENT_DESKTOP.clients[CURRENT_DESKTOP.focusedIdx];
+        Window win = c->win;
         if (win == None || win == root) return;
-        Atom wmDelete    = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
-        Atom wmProtocols = XInternAtom(dpy, "WM_PROTOCOLS", False);
-        Atom *protocols  = NULL;
-        int count;
-        if (XGetWMProtocols(dpy, win, &protocols, &count)) {
-                for (int i = 0; i < count; ++i) {
-                        if (protocols[i] == wmDelete) {
-                                XEvent ev               = {0};
-                                ev.type                 = ClientMessage;
-                                ev.xclient.window       = win;
-                                ev.xclient.message_type = wmProtocols;
-                                ev.xclient.format       = 32;
-                                ev.xclient.data.l[0]    = wmDelete;
-                                ev.xclient.data.l[1]    = CurrentTime;
-                                XSendEvent(dpy, win, False, NoEventMask, &ev);
-                                XFree(protocols);
-                                need_flush = True;
-
-                                return;
-                        }
-                }
-                XFree(protocols);
+        if (c->protocols & PROTO_DELETE) {
+                XEvent ev               = {0};
+                ev.type                 = ClientMessage;
+                ev.xclient.window       = win;
+                ev.xclient.message_type = atoms[WMProtocols];
+                ev.xclient.format       = 32;
+                ev.xclient.data.l[0]    = atoms[WMDelete];
+                ev.xclient.data.l[1]    = CurrentTime;
+                XSendEvent(dpy, win, False, NoEventMask, &ev);
+        } else {
+                XKillClient(dpy, win);
         }
-        XKillClient(dpy, win);
         need_flush = True;
 }
+// Called at map time and on WM_PROTOCOLS changes only, never from key handlers.
+static unsigned char fetchProtocols(Window win) {
+        Atom *protocols     = NULL;
+        int count           = 0;
+        unsigned char flags = 0;
+        STATS_ROUNDTRIP();
+        if (!XGetWMProtocols(dpy, win, &protocols, &count)) return 0;
+        for (int i = 0; i < count; ++i) {
+                if (protocols[i] == atoms[WMDelete]) flags |= PROTO_DELETE;
+                if (protocols[i] == atoms[NetWMSyncRequest]) flags |= PROTO_SYNC;
+        }
+        XFree(protocols);
+        return flags;
+}
+static void fetchSyncCounter(Client *c) {
+        c->counter = None;
+        if (!haveSync || !(c->protocols & PROTO_SYNC)) return;
+        Atom type;
+        int format;
+        unsigned long count, after;
+        unsigned char *data = NULL;
+        STATS_ROUNDTRIP();
+        if (XGetWindowProperty(dpy, c->win, atoms[NetWMSyncRequestCounter], 0, 1, False,
+                               XA_CARDINAL, &type, &format, &count, &after, &data) == Success) {
+                if (type == XA_CARDINAL && format == 32 && count == 1)
+                        c->counter = *(unsigned long *)data;
+                XFree(data);
+        }
+}
+static void handlePropertyNotify(XPropertyEvent *ev) {
+        if (ev->atom == atoms[NetWMState]) {
+                Client *c = clientLookup(ev->window);
+                if (!c) return;
+                if (c->netStateWrites) {
+                        c->netStateWrites--;
+                        return;
+                }
+                c->netStateLen = fetchNetState(c->win, c->netState, &c->netHidden);
+                return;
+        }
+        if (ev->atom != atoms[WMProtocols] && ev->atom != atoms[NetWMSyncRequestCounter]) return;
+        Client *c = clientLookup(ev->window);
+        if (!c) return;
+        c->protocols = fetchProtocols(ev->window);
+        TRACE_PROTOCOLS(c->win, c->protocols);
+        fetchSyncCounter(c);
+}
+static unsigned long long nowMs(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+static void clearSyncPending(Client *c) {
+        if (!c->syncPending) return;
+        c->syncPending = False;
+        syncPendingCount--;
+        layoutDirty = True;
+}
+// Asks the client to bump its counter once it has redrawn at the size that
+// follows, and arms an alarm that reports when it has.
+static void sendSyncRequest(Client *c) {
+        c->syncValue++;
+        XEvent ev               = {0};
+        ev.type                 = ClientMessage;
+        ev.xclient.window       = c->win;
+        ev.xclient.message_type = atoms[WMProtocols];
+        ev.xclient.format       = 32;
+        ev.xclient.data.l[0]    = atoms[NetWMSyncRequest];
+        ev.xclient.data.l[1]    = CurrentTime;
+        ev.xclient.data.l[2]    = c->syncValue & 0xffffffff;
+        ev.xclient.data.l[3]    = c->syncValue >> 32;
+        XSendEvent(dpy, c->win, False, NoEventMask, &ev);
+        XSyncAlarmAttributes aa;
+        XSyncIntsToValue(&aa.trigger.wait_value, c->syncValue & 0xffffffff, c->syncValue >> 32);
+        if (c->alarm == None) {
+                aa.trigger.counter    = c->counter;
+                aa.trigger.value_type = XSyncAbsolute;
+                aa.trigger.test_type  = XSyncPositiveComparison;
+                XSyncIntToValue(&aa.delta, 0);
+                aa.events = True;
+                c->alarm  = XSyncCreateAlarm(dpy,
+                                             XSyncCACounter | XSyncCAValueType | XSyncCAValue |
+                                                 XSyncCATestType | XSyncCADelta | XSyncCAEvents,
+                                             &aa);
+                if (!indexInsert(&alarmIndex, c->alarm, c)) die();
+        } else {
+                // changing the alarm also makes it active again
+                XSyncChangeAlarm(dpy, c->alarm, XSyncCAValue, &aa);
+        }
+        c->syncPending = True;
+        c->syncSentMs  = nowMs();
+        syncPendingCount++;
+        // expire the request if the client never answers
+        if (!timerDeadline[TimerSync]) setTimer(TimerSync, SYNC_TIMEOUT_MS);
+}
+static void handleSyncAlarm(XSyncAlarmNotifyEvent *ev) {
+        Client *c = indexLookup(&alarmIndex, ev->alarm);
+        if (!c) return;
+        TRACE_ALARM(c->win);
+        clearSyncPending(c);
+}
+// Gives up on clients that never acknowledged, so they get the latest size,
+// and re-arms TimerSync for the earliest request still pending.
+static void expireSyncRequests(void) {
+        unsigned long long now = nowMs(), next = 0;
+        for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
+                for (unsigned short i = 0; i < desktops[d].windowCount; i++) {
+                        Client *c = desktops[d].clients[i];
+                        if (!c->syncPending) continue;
+                        unsigned long long deadline = c->syncSentMs + SYNC_TIMEOUT_MS;
+                        if (deadline <= now) clearSyncPending(c);
+                        else if (!next || deadline < next) next = deadline;
+                }
+        }
+        timerDeadline[TimerSync] = next;
+        timersDirty              = True;
+}
+static Client *clientLookup(Window win) { return indexLookup(&windowIndex, win); }
+// reparent is False only for windows that already are children of the
+// desktop's container, i.e. ones taken over after a restart.
+static void attachClient(Client *c, unsigned char desktop, _Bool reparent) {
+        Desktop *d = &desktops[desktop];
+        if (d->windowCount == d->capacity) {
+                // slots and counts are unsigned short: a desktop that is full at
+                // USHRT_MAX is treated like running out of memory
+                if (d->capacity == USHRT_MAX) die();
+                unsigned int capacity = d->capacity * 2u;
+                if (capacity > USHRT_MAX) capacity = USHRT_MAX;
+                Client **grown = realloc(d->clients, capacity * sizeof(Client *));
+                if (!grown) die();
+                d->clients  = grown;
+                d->capacity = capacity;
+        }
+        c->desktop                 = desktop;
+        c->slot                    = d->windowCount;
+        windowStatesDirty          = True;
+        d->clients[d->windowCount] = c;
+        d->windowCount++;
+        if (!reparent) return;
+        // reparenting stacks c above every window already in the container
+        XReparentWindow(dpy, c->win, d->container, c->x, c->y);
+        for (unsigned short i = 0; i < c->slot; i++) d->clients[i]->onTop = False;
+        c->onTop = True;
+}
+static void detachClient(Client *c) {
+        Desktop *d          = &desktops[c->desktop];
+        unsigned short slot = c->slot;
+        d->windowCount--;
+        memmove(&d->clients[slot], &d->clients[slot + 1],
+                (d->windowCount - slot) * sizeof(Client *));
+        for (unsigned short i = slot; i < d->windowCount; i++) d->clients[i]->slot = i;
+        if (d->windowCount == 0) {
+                d->focusedIdx = 0;
+                return;
+        }
+        if (slot < d->focusedIdx) d->focusedIdx--;
+        if (d->focusedIdx >= d->windowCount) d->focusedIdx = d->windowCount - 1;
+        if (d == &CURRENT_DESKTOP) focusWindow(d->clients[d->focusedIdx]->win);
+}
+static Client *manageClient(Window win, unsigned char desktop, _Bool reparent) {
+        if (!freeClients) {
+                Client *chunk = calloc(POOL_CHUNK, sizeof(Client));
+                if (!chunk) die();
+                for (unsigned int i = 0; i < POOL_CHUNK; i++) {
+                        chunk[i].next = freeClients;
+                        freeClients   = &chunk[i];
+                }
+        }
+        Client *c       = freeClients;
+        freeClients     = c->next;
+        c->win          = win;
+        c->ignoreUnmaps = 0;
+        c->protocols    = 0;
+        c->x = c->y = 0;
+        c->w              = 0;
+        c->syncPending    = False;
+        c->counter        = None;
+        c->alarm          = None;
+        c->syncValue      = 0;
+        c->wmState        = WithdrawnState;
+        c->netStateWrites = 0;
+        if (!indexInsert(&windowIndex, c->win, c)) die();
+        if (clientListLen == clientListCap) {
+                clientListCap = clientListCap ? clientListCap * 2 : DESKTOP_CAPACITY;
+                Window *grown = realloc(clientList, clientListCap * sizeof(Window));
+                if (!grown) die();
+                clientList = grown;
+        }
+        clientList[clientListLen++] = win;
+        clientListDirty             = True;
+        attachClient(c, desktop, reparent);
+        return c;
+}
+// manageClient() plus everything mwm asks of a window it starts managing.
+static Client *adoptClient(Window win, unsigned char desktop, _Bool reparent) {
+        Client *c = manageClient(win, desktop, reparent);
+        XAddToSaveSet(dpy, win);
+        XSelectInput(dpy, win, PropertyChangeMask);
+        c->protocols = fetchProtocols(win);
+        TRACE_PROTOCOLS(win, c->protocols);
+        c->netStateLen = fetchNetState(win, c->netState, &c->netHidden);
+        fetchSyncCounter(c);
+        return c;
+}
+static void unmanageClient(Client *c) {
+        if (c->syncPending) {
+                c->syncPending = False;
+                syncPendingCount--;
+        }
+        if (c->alarm != None) {
+                XSyncDestroyAlarm(dpy, c->alarm);
+                indexRemove(&alarmIndex, c->alarm);
+        }
+        detachClient(c);
+        indexRemove(&windowIndex, c->win);
+        unsigned int i = 0;
+        while (clientList[i] != c->win) i++;
+        clientListLen--;
+        memmove(&clientList[i], &clientList[i + 1], (clientListLen - i) * sizeof(Window));
+        clientListDirty = True;
+        c->next         = freeClients;
+        freeClients     = c;
+}
 inline static void focusCycleWindow(_Bool forward) {
         if (CURRENT_DESKTOP.windowCount <= 1) return;
-        short idx = CURRENT_DESKTOP.focusedIdx + (forward ? 1 : -1);
+        int idx = CURRENT_DESKTOP.focusedIdx + (forward ? 1 : -1);
         idx += CURRENT_DESKTOP.windowCount * (idx < 0);
         idx -= CURRENT_DESKTOP.windowCount * (idx >= CURRENT_DESKTOP.windowCount);
         CURRENT_DESKTOP.focusedIdx = idx;
-        focusWindow(CURRENT_DESKTOP.windows[idx]);
+        focusWindow(CURRENT_DESKTOP.clients[idx]->win);
+        // tiled windows never overlap; stacked ones need the focused one raised
+        if (CURRENT_DESKTOP.layout == LayoutMonocle) layoutDirty = True;
 }
 static void handleKeyPress(XEvent *e) {
-        XKeyEvent *ev      = &e->xkey;
-        KeySym keysym      = XkbKeycodeToKeysym(dpy, ev->keycode, 0, 0);
-        unsigned int state = ev->state;
-        if (keysym == XK_q && state == (MOD_KEY | ShiftMask)) {
-                running = 0;
-                return;
+        STATS_SPAN(StatsKeyPress);
+        XKeyEvent *ev = &e->xkey;
+        if (ev->state != MOD_KEY && ev->state != (MOD_KEY | ShiftMask)) return;
+        KeyAction a = keyTable[ev->keycode][(ev->state & ShiftMask) != 0];
+        switch (a.action) {
+                case ActQuit:
+                        running = False;
+                        break;
+                case ActRestart:
+                        restarting = True;
+                        running    = False;
+                        break;
+                case ActKill:
+                        killFocusedWindow();
+                        break;
+                case ActFocus:
+                        focusCycleWindow(a.arg);
+                        break;
+                case ActResize:
+                        resizeMaster(a.arg ? RESIZE_STEP : -RESIZE_STEP);
+                        break;
+                case ActLayout:
+                        setLayout((CURRENT_DESKTOP.layout + 1) % LayoutLast);
+                        break;
+                case ActDesktop:
+                        switchDesktop(a.arg);
+                        break;
+                case ActMove:
+                        if (CURRENT_DESKTOP.windowCount == 0) break;
+                        moveWindowToDesktop(
+                            CURRENT_DESKTOP.clients[CURRENT_DESKTOP.focusedIdx]->win, a.arg);
+                        break;
+                case ActLaunch:
+#ifdef AUDIO_HELPER
+                        if (sendAudioCommand(launchers[a.arg].keysym)) break;
+#endif
+                        launchSpawn(launcherArgv[a.arg], launchers[a.arg].command);
+                        break;
+                default:
+                        break;
         }
-        if ((keysym == XK_h || keysym == XK_l) && state == (MOD_KEY | ShiftMask)) {
-                short *rd = &resizeDelta[currentDesktop];
-                *rd += (keysym == XK_l) ? RESIZE_STEP : -RESIZE_STEP;
-                if (*rd < -(screen_width / 2 - 100)) *rd = -(screen_width / 2 - 100);
-                if (*rd > (screen_width / 2 - 100)) *rd = (screen_width / 2 - 100);
-                tileWindows();
-                return;
+}
+static void resizeMaster(int delta) {
+        int limit = screen_width / 2 - 100;
+        int rd    = resizeDelta[currentDesktop] + delta;
+        if (rd < -limit) rd = -limit;
+        if (rd > limit) rd = limit;
+        resizeDelta[currentDesktop] = rd;
+        layoutDirty                 = True;
+}
+static void setLayout(unsigned char layout) {
+        if (layout >= LayoutLast || layout == CURRENT_DESKTOP.layout) return;
+        CURRENT_DESKTOP.layout = layout;
+        layoutDirty            = True;
+}
+#ifdef AUDIO_HELPER
+static void startAudioHelper(void) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) return;
+        pid_t pid = fork();
+        if (pid == 0) {
+                sigset_t none;
+                sigemptyset(&none);
+                sigprocmask(SIG_SETMASK, &none, NULL);
+                setsid();
+                // dup2 clears close-on-exec on the helper's stdin and stdout
+                dup2(sv[1], 0);
+                dup2(sv[1], 1);
+                execl(AUDIO_HELPER, AUDIO_HELPER, "-d", NULL);
+                _exit(EXIT_FAILURE);
         }
-        if (keysym == XK_q && state == MOD_KEY) {
-                killFocusedWindow();
+        close(sv[1]);
+        if (pid == -1) {
+                close(sv[0]);
                 return;
         }
-        if ((keysym == XK_j || keysym == XK_k) && state == MOD_KEY) {
-                focusCycleWindow(keysym == XK_j ? True : False);
+        audioSource.fd = sv[0];
+        fcntl(audioSource.fd, F_SETFL, O_NONBLOCK);
+        addSource(&audioSource);
+}
+// One byte per key press; the helper merges whatever has queued up.
+static _Bool sendAudioCommand(KeySym keysym) {
+        char cmd;
+        switch (keysym) {
+                case XF86XK_AudioRaiseVolume:
+                        cmd = '+';
+                        break;
+                case XF86XK_AudioLowerVolume:
+                        cmd = '-';
+                        break;
+                case XF86XK_AudioMute:
+                        cmd = 'a';
+                        break;
+                case XF86XK_AudioMicMute:
+                        cmd = 'm';
+                        break;
+                default:
+                        return False;
+        }
+        if (audioSource.fd < 0) return False;
+        if (send(audioSource.fd, &cmd, 1, MSG_NOSIGNAL) == 1 || errno == EAGAIN) return True;
+        // the helper exited: AUDIO_SCRIPT handles this and later presses
+        TRACE_AUDIO_GONE();
+        removeSource(&audioSource);
+        return False;
+}
+// Status lines are drained so the helper never blocks on a full socket, and
+// the newest one goes to the OSD. A helper that exited leaves media keys to
+// AUDIO_SCRIPT.
+static void readAudioReplies(Source *src) {
+        char buf[128];
+        ssize_t n;
+        while ((n = read(src->fd, buf, sizeof(buf))) > 0) {
+                // the helper writes whole replies; take the last line in them
+                ssize_t end = n;
+                while (end > 0 && buf[end - 1] == '\n') end--;
+                ssize_t start = end;
+                while (start > 0 && buf[start - 1] != '\n') start--;
+                if (end == start) continue;
+                TRACE_AUDIO(buf + start, end - start);
+                showOsd(buf + start, end - start);
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                TRACE_AUDIO_GONE();
+                removeSource(src);
+        }
+}
+// Pre-creates the OSD unmapped. It is override-redirect, so mwm never
+// manages it, and only wants Expose to redraw itself.
+static void createOsd(void) {
+        STATS_ROUNDTRIP();
+        osdFont = XLoadQueryFont(dpy, OSD_FONT);
+        if (!osdFont) return;
+        int screen              = DefaultScreen(dpy);
+        XSetWindowAttributes wa = {0};
+        wa.override_redirect    = True;
+        wa.background_pixel     = BlackPixel(dpy, screen);
+        wa.border_pixel         = WhitePixel(dpy, screen);
+        wa.event_mask           = ExposureMask;
+        osd = XCreateWindow(dpy, root, 0, 0, 1, 1, 1, CopyFromParent, InputOutput, CopyFromParent,
+                            CWOverrideRedirect | CWBackPixel | CWBorderPixel | CWEventMask, &wa);
+        XGCValues gv;
+        gv.foreground = WhitePixel(dpy, screen);
+        gv.background = BlackPixel(dpy, screen);
+        gv.font       = osdFont->fid;
+        osdGC         = XCreateGC(dpy, osd, GCForeground | GCBackground | GCFont, &gv);
+}
+static void drawOsd(void) {
+        XClearWindow(dpy, osd);
+        XDrawString(dpy, osd, osdGC, OSD_PAD, OSD_PAD + osdFont->ascent, osdText, osdLen);
+}
+// Sizes the window to the text, centred in the lower part of the screen, and
+// (re)starts the hide timer.
+static void showOsd(const char *text, unsigned int len) {
+        if (!osdGC) return;
+        if (len > sizeof(osdText)) len = sizeof(osdText);
+        memcpy(osdText, text, len);
+        osdLen = len;
+        XWindowChanges wc;
+        wc.width      = XTextWidth(osdFont, osdText, osdLen) + 2 * OSD_PAD;
+        wc.height     = osdFont->ascent + osdFont->descent + 2 * OSD_PAD;
+        wc.x          = (screen_width - wc.width) / 2;
+        wc.y          = screen_height * 3 / 4;
+        wc.stack_mode = Above;
+        XConfigureWindow(dpy, osd, CWX | CWY | CWWidth | CWHeight | CWStackMode, &wc);
+        if (!osdShown) XMapWindow(dpy, osd);
+        osdShown = True;
+        drawOsd();
+        setTimer(TimerOsd, OSD_MS);
+        need_flush = True;
+}
+static void hideOsd(void) {
+        XUnmapWindow(dpy, osd);
+        osdShown   = False;
+        need_flush = True;
+}
+#endif
+// True if controlAddr is free for bind(), after removing a socket left behind
+// by a crashed mwm. Anything else there, or a socket that still accepts
+// connections, is left alone.
+static _Bool controlPathFree(void) {
+        struct stat st;
+        if (lstat(controlAddr.sun_path, &st) == -1) return errno == ENOENT;
+        if (!S_ISSOCK(st.st_mode)) return False;
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe == -1) return False;
+        int r = connect(probe, (struct sockaddr *)&controlAddr, sizeof(controlAddr));
+        _Bool refused = r == -1 && errno == ECONNREFUSED;
+        close(probe);
+        return refused && unlink(controlAddr.sun_path) == 0;
+}
+// Listens on $MWM_SOCKET, or $XDG_RUNTIME_DIR/mwm-$DISPLAY.sock. Without a
+// usable path mwm simply runs without a control socket.
+static void startControlSocket(void) {
+        const char *path = getenv("MWM_SOCKET");
+        int len;
+        for (unsigned char i = 0; i < CONTROL_CONNS; i++)
+                controlConns[i].src = (Source){-1, readControl};
+        controlAddr.sun_family = AF_UNIX;
+        if (path) {
+                len = snprintf(controlAddr.sun_path, sizeof(controlAddr.sun_path), "%s", path);
+        } else {
+                const char *dir = getenv("XDG_RUNTIME_DIR");
+                if (!dir) return;
+                len = snprintf(controlAddr.sun_path, sizeof(controlAddr.sun_path),
+                               "%s/mwm-%s.sock", dir, getenv("DISPLAY"));
+        }
+        if (len <= 0 || len >= (int)sizeof(controlAddr.sun_path)) return;
+        if (!controlPathFree()) return;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) return;
+        if (bind(fd, (struct sockaddr *)&controlAddr, sizeof(controlAddr)) == -1 ||
+            listen(fd, CONTROL_CONNS) == -1) {
+                close(fd);
                 return;
         }
-        if (keysym >= XK_1 && keysym <= XK_9) {
-                unsigned char num = keysym - XK_1;
-                Window focused;
-                int revert_to;
-                XGetInputFocus(dpy, &focused, &revert_to);
-                if (state == MOD_KEY) {
-                        switchDesktop(num);
-                } else if (state == (MOD_KEY | ShiftMask) && focused != None && focused != root) {
-                        moveWindowToDesktop(focused, num);
+        controlSource.fd = fd;
+        addSource(&controlSource);
+}
+static void acceptControl(Source *src) {
+        int fd;
+        while ((fd = accept4(src->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                unsigned char i = 0;
+                while (i < CONTROL_CONNS && controlConns[i].src.fd >= 0) i++;
+                if (i == CONTROL_CONNS) {
+                        close(fd);
+                        continue;
                 }
-                return;
+                controlConns[i].src.fd   = fd;
+                controlConns[i].len      = 0;
+                controlConns[i].overlong = False;
+                addSource(&controlConns[i].src);
         }
-        for (unsigned int i = 0; i < ARRAY_LEN(launchers); i++) {
-                if (keysym == launchers[i].keysym && state == MOD_KEY) {
-                        if (fork() == 0) {
-                                if (fork() == 0) {
-                                        setsid();
-                                        for (int fd = 0; fd <= 2; fd++) close(fd);
-                                        execl("/bin/sh", "sh", "-c", launchers[i].command, NULL);
-                                        _exit(EXIT_FAILURE);
-                                }
-                                _exit(EXIT_SUCCESS);
+}
+// Replies never block the event loop: a client that stops reading loses them.
+static void controlReply(ControlConn *conn, const char *fmt, ...) {
+        char buf[CONTROL_LINE];
+        va_list ap;
+        va_start(ap, fmt);
+        int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        if (len >= (int)sizeof(buf)) len = sizeof(buf) - 1;
+        __attribute__((unused)) ssize_t _ =
+            send(conn->src.fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+// A whole decimal argument within [min, max]; anything else is answered with
+// an error.
+static _Bool controlNumber(ControlConn *conn, const char *arg, long min, long max, long *out) {
+        char *end;
+        errno  = 0;
+        long v = strtol(arg, &end, 10);
+        if (errno || end == arg || *end || v < min || v > max) {
+                controlReply(conn, "error %s\n", arg);
+                return False;
+        }
+        *out = v;
+        return True;
+}
+// Desktops are numbered from 1, as on the keyboard.
+static void runControlCommand(ControlConn *conn, char *line) {
+        char *cmd = strtok(line, " \t");
+        char *arg = strtok(NULL, " \t");
+        if (!cmd) return;
+        Desktop *cur    = &CURRENT_DESKTOP;
+        Client *focused = cur->windowCount ? cur->clients[cur->focusedIdx] : NULL;
+        long n;
+        if (!strcmp(cmd, "desktop") && arg) {
+                if (controlNumber(conn, arg, 1, MAX_DESKTOPS, &n)) switchDesktop(n - 1);
+        } else if (!strcmp(cmd, "move") && arg && focused) {
+                if (controlNumber(conn, arg, 1, MAX_DESKTOPS, &n))
+                        moveWindowToDesktop(focused->win, n - 1);
+        } else if (!strcmp(cmd, "focus") && arg && !strcmp(arg, "next")) {
+                focusCycleWindow(True);
+        } else if (!strcmp(cmd, "focus") && arg && !strcmp(arg, "prev")) {
+                focusCycleWindow(False);
+        } else if (!strcmp(cmd, "resize") && arg) {
+                // resizeMaster() clamps to half the screen anyway
+                if (controlNumber(conn, arg, -screen_width, screen_width, &n)) resizeMaster(n);
+        } else if (!strcmp(cmd, "layout") && arg) {
+                unsigned char l = 0;
+                while (l < LayoutLast && strcmp(arg, layoutNames[l])) l++;
+                if (!strcmp(arg, "next")) l = (cur->layout + 1) % LayoutLast;
+                if (l == LayoutLast) controlReply(conn, "error %s\n", arg);
+                setLayout(l);
+        } else if (!strcmp(cmd, "kill")) {
+                killFocusedWindow();
+        } else if (!strcmp(cmd, "quit")) {
+                running = False;
+        } else if (!strcmp(cmd, "restart")) {
+                restarting = True;
+                running    = False;
+        } else if (!strcmp(cmd, "get") && arg && !strcmp(arg, "desktop")) {
+                controlReply(conn, "%u\n", currentDesktop + 1);
+        } else if (!strcmp(cmd, "get") && arg && !strcmp(arg, "layout")) {
+                controlReply(conn, "%s\n", layoutNames[cur->layout]);
+        } else if (!strcmp(cmd, "get") && arg && !strcmp(arg, "focused")) {
+                controlReply(conn, "0x%lx\n", focused ? focused->win : None);
+        } else if (!strcmp(cmd, "get") && arg && !strcmp(arg, "clients")) {
+                // geometry is what the last relayout sent, terminated by an empty line
+                for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
+                        for (unsigned short i = 0; i < desktops[d].windowCount; i++) {
+                                Client *c = desktops[d].clients[i];
+                                controlReply(conn, "0x%lx %u %d %d %u %u%s\n", c->win, d + 1,
+                                             c->x, c->y, c->w, c->h,
+                                             c == focused ? " focused" : "");
                         }
-                        return;
                 }
+                controlReply(conn, "\n");
+        } else {
+                controlReply(conn, "error %s\n", cmd);
         }
 }
-static void moveWindowToDesktop(Window win, unsigned char desktop) {
-        if (desktop >= MAX_DESKTOPS || desktop == currentDesktop) return;
-        if (DESKTOPS[desktop].windowCount >= MAX_WINDOWS_PER_DESKTOP) return;
-        for (unsigned char i = 0; i < CURRENT_DESKTOP.windowCount; i++) {
-                if (CURRENT_DESKTOP.windows[i] == win) {
-                        removeWindowFromDesktop(win, &CURRENT_DESKTOP);
-                        unsigned char idx               = DESKTOPS[desktop].windowCount;
-                        DESKTOPS[desktop].windows[idx]  = win;
-                        DESKTOPS[desktop].isMapped[idx] = False;
-                        DESKTOPS[desktop].windowCount++;
-                        XUnmapWindow(dpy, win);
-                        tileWindows();
-                        return;
+// Runs the line that has been collected in conn->buf.
+static void controlLine(ControlConn *conn) {
+        conn->buf[conn->len] = '\0';
+        TRACE_CONTROL(conn->buf, conn->len, conn->overlong);
+        // a truncated line could still parse as some other command
+        if (conn->overlong)
+                controlReply(conn, "error line too long\n");
+        else
+                runControlCommand(conn, conn->buf);
+        conn->len      = 0;
+        conn->overlong = False;
+}
+static void readControl(Source *src) {
+        ControlConn *conn = (ControlConn *)src;
+        char buf[512];
+        ssize_t n;
+        while ((n = read(src->fd, buf, sizeof(buf))) > 0) {
+                for (ssize_t i = 0; i < n; i++) {
+                        if (buf[i] == '\n') {
+                                controlLine(conn);
+                        } else if (conn->len < CONTROL_LINE - 1) {
+                                conn->buf[conn->len++] = buf[i];
+                        } else {
+                                conn->overlong = True;
+                        }
                 }
         }
+        need_flush = True;
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) removeSource(src);
+}
+static void moveWindowToDesktop(Window win, unsigned char desktop) {
+        if (desktop >= MAX_DESKTOPS || desktop == currentDesktop) return;
+        Client *c = clientLookup(win);
+        if (!c || c->desktop != currentDesktop) return;
+        detachClient(c);
+        // the server unmaps c before reparenting it and maps it again after;
+        // the hidden container keeps it invisible
+        c->ignoreUnmaps++;
+        attachClient(c, desktop, True);
+        layoutDirty = True;
 }
 inline static void focusWindow(Window w) {
         if (w == None) return;
         XSetInputFocus(dpy, w, RevertToParent, CurrentTime);
 }
-static void removeWindowFromDesktop(Window win, Desktop *d) {
-        unsigned int write     = 0;
-        unsigned char newFocus = d->focusedIdx;
-        for (unsigned int read = 0; read < d->windowCount; read++) {
-                if (d->windows[read] != win) {
-                        d->windows[write]  = d->windows[read];
-                        d->isMapped[write] = d->isMapped[read];
-                        if (read == d->focusedIdx) newFocus = write;
-                        write++;
-                }
-        }
-        d->windowCount = write;
-        if (write == 0) {
-                d->focusedIdx = 0;
-                return;
-        }
-        if (newFocus >= write) newFocus = write - 1;
-        d->focusedIdx = newFocus;
-        if (d->isMapped[d->focusedIdx]) focusWindow(d->windows[d->focusedIdx]);
-}
 static void handleDestroyNotify(Window win) {
-        for (unsigned char d_idx = 0; d_idx < MAX_DESKTOPS; d_idx++) {
-                Desktop *d = &desktops[d_idx];
-                for (unsigned char i = 0; i < d->windowCount; i++) {
-                        if (d->windows[i] == win) {
-                                removeWindowFromDesktop(win, d);
-                                if (d_idx == currentDesktop) {
-                                        tileWindows();
-                                }
-                                return;
-                        }
-                }
-        }
+        STATS_SPAN(StatsDestroyNotify);
+        Client *c = clientLookup(win);
+        if (!c) return;
+        unsigned char desktop = c->desktop;
+        unmanageClient(c);
+        if (desktop == currentDesktop) layoutDirty = True;
 }
 static void cleanup(void) {
         for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
-                for (unsigned char i = 0; i < desktops[d].windowCount; i++) {
-                        XUnmapWindow(dpy, desktops[d].windows[i]);
+                for (unsigned short i = 0; i < desktops[d].windowCount; i++) {
+                        Client *c = desktops[d].clients[i];
+                        XUnmapWindow(dpy, c->win);
+                        XReparentWindow(dpy, c->win, root, c->x, c->y);
                 }
         }
+        if (controlSource.fd >= 0) unlink(controlAddr.sun_path);
+        // containers taken over at a restart belong to the first mwm's retained
+        // client; killing it destroys them and frees its server resources
+        if (!ownContainers) XKillClient(dpy, desktops[0].container);
+        XDestroyWindow(dpy, wmCheck);
+        for (unsigned char a = NetSupported; a < AtomLast; a++)
+                XDeleteProperty(dpy, root, atoms[a]);
         XCloseDisplay(dpy);
 }
+// Sends one XConfigureWindow carrying only what changed since the last call
+// for this client; nothing at all when geometry and stacking are unchanged.
+static void configureClient(Client *c, int x, int y, unsigned int w, unsigned int h,
+                            _Bool raise) {
+        XWindowChanges wc;
+        unsigned int mask = 0;
+        _Bool resized     = c->w != w || c->h != h;
+        if (resized && c->counter != None) {
+                // drop this step; the relayout after the client's ack (or the
+                // timeout) sends whatever size is current by then
+                if (c->syncPending && nowMs() - c->syncSentMs < SYNC_TIMEOUT_MS) {
+                        configuresDeferred++;
+                        resized = False;
+                        x       = c->x;
+                        y       = c->y;
+                        w       = c->w;
+                        h       = c->h;
+                } else {
+                        clearSyncPending(c);
+                        sendSyncRequest(c);
+                }
+        }
+        if (resized || c->x != x || c->y != y) {
+                wc.x      = c->x = x;
+                wc.y      = c->y = y;
+                wc.width  = c->w = w;
+                wc.height = c->h = h;
+                mask      = CWX | CWY | CWWidth | CWHeight;
+        }
+        if (raise && !c->onTop) {
+                wc.stack_mode = Above;
+                mask |= CWStackMode;
+                for (unsigned short i = 0; i < CURRENT_DESKTOP.windowCount; i++)
+                        CURRENT_DESKTOP.clients[i]->onTop = False;
+                c->onTop = True;
+        }
+        if (!mask) {
+                configuresSkipped++;
+                return;
+        }
+        XConfigureWindow(dpy, c->win, mask, &wc);
+        configuresSent++;
+}
 static void tileWindows(void) {
-        const unsigned char n = CURRENT_DESKTOP.windowCount;
+        STATS_SPAN(StatsTileWindows);
+        const unsigned short n = CURRENT_DESKTOP.windowCount;
         if (n == 0) return;
-        if (n == 1) {
-                Window w = CURRENT_DESKTOP.windows[0];
-                XMoveResizeWindow(dpy, w, 0, 0, screen_width, screen_height);
-                XRaiseWindow(dpy, w);
-                return;
+        if (n > layoutBufLen) {
+                Geometry *grown = realloc(layoutBuf, CURRENT_DESKTOP.capacity * sizeof(Geometry));
+                if (!grown) die();
+                layoutBuf    = grown;
+                layoutBufLen = CURRENT_DESKTOP.capacity;
+        }
+        layoutApply(CURRENT_DESKTOP.layout, n, screen_width, screen_height,
+                    resizeDelta[currentDesktop], layoutBuf);
+        const unsigned short focused = CURRENT_DESKTOP.focusedIdx;
+        for (unsigned short i = 0; i < n; i++) {
+                Geometry *g = &layoutBuf[i];
+                // a lone window is raised even if focus is elsewhere
+                configureClient(CURRENT_DESKTOP.clients[i], g->x, g->y, g->w, g->h,
+                                focused == i || n == 1);
         }
-        int half = screen_width >> 1;
-        int mw   = half + resizeDelta[currentDesktop];
-        if (mw < 100)
-                mw = 100;
-        else if (mw > (int)screen_width - 100)
-                mw = screen_width - 100;
-        unsigned int masterWidth = (unsigned int)mw;
-        unsigned int stackWidth  = screen_width - masterWidth;
-        unsigned int stackCount  = n - 1;
-        unsigned int stackHeight = screen_height / stackCount;
-        Window master            = CURRENT_DESKTOP.windows[0];
-        XMoveResizeWindow(dpy, master, 0, 0, masterWidth, screen_height);
-        for (unsigned int i = 1; i < n; i++) {
-                Window w       = CURRENT_DESKTOP.windows[i];
-                unsigned int y = (i - 1) * stackHeight;
-                XMoveResizeWindow(dpy, w, masterWidth, y, stackWidth, stackHeight);
-        }
-        XRaiseWindow(dpy, CURRENT_DESKTOP.windows[CURRENT_DESKTOP.focusedIdx]);
 }
 static void handleMapRequest(Window win) {
-        for (unsigned char i = 0; i < CURRENT_DESKTOP.windowCount; i++) {
-                if (CURRENT_DESKTOP.windows[i] == win) {
-                        CURRENT_DESKTOP.focusedIdx = i;
-                        if (!CURRENT_DESKTOP.isMapped[i]) {
-                                XMapWindow(dpy, win);
-                                CURRENT_DESKTOP.isMapped[i] = True;
-                        }
-                        focusWindow(win);
-                        tileWindows();
-                        return;
+        STATS_SPAN(StatsMapRequest);
+        Client *c = clientLookup(win);
+        if (c) {
+                // a window remapping itself while its desktop is hidden joins the
+                // current one
+                if (c->desktop != currentDesktop) {
+                        detachClient(c);
+                        attachClient(c, currentDesktop, True);
                 }
-        }
-        if (CURRENT_DESKTOP.windowCount < MAX_WINDOWS_PER_DESKTOP) {
-                unsigned char idx             = CURRENT_DESKTOP.windowCount;
-                CURRENT_DESKTOP.windows[idx]  = win;
-                CURRENT_DESKTOP.isMapped[idx] = True;
-                CURRENT_DESKTOP.windowCount++;
-                CURRENT_DESKTOP.focusedIdx = idx;
+                CURRENT_DESKTOP.focusedIdx = c->slot;
                 XMapWindow(dpy, win);
                 focusWindow(win);
-                tileWindows();
-        } else {
-                XKillClient(dpy, win);
-                need_flush = True;
+                layoutDirty = True;
+                return;
         }
+        c                          = adoptClient(win, currentDesktop, True);
+        CURRENT_DESKTOP.focusedIdx = c->slot;
+        XMapWindow(dpy, win);
+        focusWindow(win);
+        layoutDirty = True;
 }
 static void switchDesktop(unsigned char newDesk) {
-        if (newDesk == currentDesktop || newDesk >= MAX_DESKTOPS || IsSwitching) return;
-        IsSwitching = 1;
-        for (unsigned int i = 0; i < CURRENT_DESKTOP.windowCount; i++) {
-                if (CURRENT_DESKTOP.isMapped[i]) {
-                        XUnmapWindow(dpy, CURRENT_DESKTOP.windows[i]);
-                        CURRENT_DESKTOP.isMapped[i] = False;
-                }
-        }
-        currentDesktop = newDesk;
-        for (unsigned int i = 0; i < CURRENT_DESKTOP.windowCount; i++) {
-                XMapWindow(dpy, CURRENT_DESKTOP.windows[i]);
-                CURRENT_DESKTOP.isMapped[i] = True;
-        }
-        tileWindows();
+        STATS_SPAN(StatsSwitchDesktop);
+        if (newDesk == currentDesktop || newDesk >= MAX_DESKTOPS) return;
+        // stack the new container right above the old one and map it first, so
+        // the root background never shows through in between and override-
+        // redirect windows such as menus or the OSD stay on top
+        XWindowChanges wc = {.sibling = CURRENT_DESKTOP.container, .stack_mode = Above};
+        XConfigureWindow(dpy, desktops[newDesk].container, CWSibling | CWStackMode, &wc);
+        XMapWindow(dpy, desktops[newDesk].container);
+        XUnmapWindow(dpy, CURRENT_DESKTOP.container);
+        currentDesktop    = newDesk;
+        layoutDirty       = True;
+        windowStatesDirty = True;
         if (CURRENT_DESKTOP.windowCount > 0)
-                focusWindow(CURRENT_DESKTOP.windows[CURRENT_DESKTOP.focusedIdx]);
-        IsSwitching = 0;
+                focusWindow(CURRENT_DESKTOP.clients[CURRENT_DESKTOP.focusedIdx]->win);
+}
+// Scans the queue without removing anything for the window's DestroyNotify,
+// up to a MapRequest that would make it a new client.
+static Bool destroyPending(Display *d, XEvent *e, XPointer arg) {
+        PendingDestroy *p = (PendingDestroy *)arg;
+        (void)d;
+        if (e->type == MapRequest && e->xmaprequest.window == p->win) p->remapped = True;
+        if (e->type == DestroyNotify && e->xdestroywindow.window == p->win && !p->remapped)
+                p->destroyed = True;
+        return False;
 }
 static void handleUnmapNotify(Window win) {
-        if (IsSwitching) return;
-        for (unsigned char i = 0; i < CURRENT_DESKTOP.windowCount; i++) {
-                if (CURRENT_DESKTOP.windows[i] == win) {
-                        CURRENT_DESKTOP.isMapped[i] = False;
-                        removeWindowFromDesktop(win, &CURRENT_DESKTOP);
-                        tileWindows();
-                        return;
-                }
+        STATS_SPAN(StatsUnmapNotify);
+        Client *c = clientLookup(win);
+        if (!c) return;
+        if (c->ignoreUnmaps) {
+                c->ignoreUnmaps--;
+                return;
         }
+        if (c->desktop == currentDesktop) layoutDirty = True;
+        // a client that exited is unmapped and destroyed in one go: the
+        // requests below would only draw BadWindow
+        PendingDestroy pending = {win, False, False};
+        XEvent ev;
+        XCheckIfEvent(dpy, &ev, destroyPending, (XPointer)&pending);
+        if (!pending.destroyed) setWindowState(c, WithdrawnState);
+        unmanageClient(c);
+        if (pending.destroyed) return;
+        // withdrawn: hand the window back to the root so that the save-set
+        // does not map it again when mwm exits
+        XReparentWindow(dpy, win, root, 0, 0);
+        XRemoveFromSaveSet(dpy, win);
 }
@@ -0,0 +1,600 @@
+// XCB port of mwm's window management core, built with `make mwm-xcb` to
+// compare the two client libraries on the same hot paths: per-desktop
+// containers, the client index, keyTable dispatch, layout.h layouts behind
+// a geometry cache, and one relayout and flush per drained event batch.
+// Requests are pipelined: replies are fetched through cookies only when
+// needed and events are drained in batches with xcb_poll_for_event.
+//
+// Only that core subset is ported; everything else mwm does stays in main.c.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+
+#include "index.h"
+#include "launch.h"
+#include "layout.h"
+#define RESIZE_STEP 30
+#define MAX_DESKTOPS 9// 256 limit
+// clients come from a pool and slot arrays only grow: nothing allocates once
+// a session has reached its high-water mark
+#define POOL_CHUNK 64
+#define DESKTOP_CAPACITY 16
+#define MAX_PENDING_REPLIES 32
+#define CURRENT_DESKTOP desktops[currentDesktop]
+#define DEFAULT_LAYOUT LayoutTile
+#include "keys.h"
+#define PROTO_DELETE (1 << 0)
+typedef struct Client {
+        xcb_window_t win;
+        // UnmapNotify events caused by our own reparenting, not by the client
+        unsigned char ignoreUnmaps;
+        unsigned char protocols;
+        unsigned char desktop;
+        unsigned short slot;// position in desktops[desktop].clients
+        // last geometry and stacking sent to the server; w == 0 until tiled once
+        short x, y;
+        unsigned short w, h;
+        _Bool onTop;
+        struct Client *next;// free list link
+} Client;
+typedef struct {
+        xcb_window_t container;
+        Client **clients;
+        unsigned short windowCount;
+        unsigned short capacity;
+        unsigned short focusedIdx;
+        unsigned char layout;
+} Desktop;
+// WM_PROTOCOLS reads issued at map time; replies are collected after the
+// event batch has been flushed, so the map itself never waits on the server.
+typedef struct {
+        xcb_window_t win;
+        xcb_get_property_cookie_t cookie;
+} PendingProtocols;
+static xcb_connection_t *conn;
+#define ARRAY_LEN(arr) (sizeof(arr) / sizeof((arr)[0]))
+enum { WMProtocols, WMDelete, AtomLast };
+static const char *atomNames[AtomLast] = {"WM_PROTOCOLS", "WM_DELETE_WINDOW"};
+static xcb_atom_t atoms[AtomLast];
+static char *launcherArgv[ARRAY_LEN(launchers)][LAUNCH_MAX_ARGS];
+static Desktop desktops[MAX_DESKTOPS];
+static xcb_window_t root;
+static Client *freeClients = NULL;
+static XidIndex windowIndex;
+static unsigned char currentDesktop  = 0;
+static volatile sig_atomic_t running = 1;
+static short resizeDelta[MAX_DESKTOPS] = {0};
+static unsigned short screen_width, screen_height;
+static _Bool need_flush  = 0;
+static _Bool layoutDirty = 0;
+static _Bool keysDirty = 0;
+static Geometry *layoutBuf;
+static unsigned short layoutBufLen = 0;
+static PendingProtocols pending[MAX_PENDING_REPLIES];
+static unsigned char pendingCount = 0;
+
+static void setup(void);
+static void run(void);
+static void cleanup(void);
+static void handleEvent(xcb_generic_event_t *e);
+static void handleKeyPress(xcb_key_press_event_t *ev);
+static void handleMapRequest(xcb_window_t win);
+static void handleUnmapNotify(xcb_window_t win);
+static void handleDestroyNotify(xcb_window_t win);
+static void handlePropertyNotify(xcb_property_notify_event_t *ev);
+static void requestProtocols(xcb_window_t win);
+static void collectProtocols(void);
+inline static void focusWindow(xcb_window_t w);
+static void tileWindows(void);
+static void switchDesktop(unsigned char desktop);
+static void moveWindowToDesktop(xcb_window_t win, unsigned char desktop);
+static Client *clientLookup(xcb_window_t win);
+static Client *manageClient(xcb_window_t win, unsigned char desktop);
+static void unmanageClient(Client *c);
+static void attachClient(Client *c, unsigned char desktop);
+static void detachClient(Client *c);
+static void grabKeys(xcb_get_keyboard_mapping_cookie_t cookie);
+static xcb_get_keyboard_mapping_cookie_t requestKeymap(void);
+static void sigHandler(int);
+static void killFocusedWindow(void);
+inline static void focusCycleWindow(_Bool);// 1 bit
+inline static void die(void);
+int main(void) {
+        // launchers are reaped by the kernel
+        signal(SIGCHLD, SIG_IGN);
+        signal(SIGTERM, sigHandler);
+        signal(SIGINT, sigHandler);
+        setup();
+        run();
+        cleanup();
+        return EXIT_SUCCESS;
+}
+inline static void die(void) {
+        __attribute__((unused)) char _ = write(2, "mwm:error\n", 10);
+        _exit(1);
+}
+static void sigHandler(int sig) {
+        (void)sig;
+        running = 0;
+}
+static void setup(void) {
+        if (!getenv("DISPLAY")) die();
+        int screenNum;
+        conn = xcb_connect(NULL, &screenNum);
+        if (xcb_connection_has_error(conn)) die();
+        const xcb_setup_t *xsetup    = xcb_get_setup(conn);
+        xcb_screen_iterator_t screen = xcb_setup_roots_iterator(xsetup);
+        for (int i = 0; i < screenNum; i++) xcb_screen_next(&screen);
+        root          = screen.data->root;
+        screen_width  = screen.data->width_in_pixels;
+        screen_height = screen.data->height_in_pixels;
+        // Everything below is sent in one go; the only waits are the reply
+        // collections at the end.
+        xcb_intern_atom_cookie_t atomCookies[AtomLast];
+        for (unsigned char i = 0; i < AtomLast; i++) {
+                atomCookies[i] = xcb_intern_atom(conn, 0, strlen(atomNames[i]), atomNames[i]);
+        }
+        xcb_get_keyboard_mapping_cookie_t keymapCookie = requestKeymap();
+        uint32_t mask = XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT |
+                        XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY | XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+        xcb_void_cookie_t redirect = xcb_change_window_attributes_checked(
+            conn, root, XCB_CW_EVENT_MASK, &mask);
+        xcb_font_t font = xcb_generate_id(conn);
+        xcb_open_font(conn, font, 6, "cursor");
+        xcb_cursor_t cursor = xcb_generate_id(conn);
+        xcb_create_glyph_cursor(conn, cursor, font, font, 68, 69, 0, 0, 0, 0xffff, 0xffff,
+                                0xffff);
+        xcb_change_window_attributes(conn, root, XCB_CW_CURSOR, &cursor);
+        xcb_close_font(conn, font);
+        // one override-redirect container per desktop; only the current one is mapped
+        const uint32_t containerValues[] = {
+            XCB_BACK_PIXMAP_PARENT_RELATIVE, 1,
+            XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY};
+        for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
+                desktops[d].container = xcb_generate_id(conn);
+                xcb_create_window(conn, XCB_COPY_FROM_PARENT, desktops[d].container, root, 0, 0,
+                                  screen_width, screen_height, 0,
+                                  XCB_WINDOW_CLASS_INPUT_OUTPUT, XCB_COPY_FROM_PARENT,
+                                  XCB_CW_BACK_PIXMAP | XCB_CW_OVERRIDE_REDIRECT |
+                                      XCB_CW_EVENT_MASK,
+                                  containerValues);
+                desktops[d].clients = malloc(DESKTOP_CAPACITY * sizeof(Client *));
+                if (!desktops[d].clients) die();
+                desktops[d].capacity = DESKTOP_CAPACITY;
+                desktops[d].layout   = DEFAULT_LAYOUT;
+        }
+        xcb_map_window(conn, CURRENT_DESKTOP.container);
+        if (!indexInit(&windowIndex)) die();
+        for (unsigned char i = 0; i < ARRAY_LEN(launchers); i++) {
+                char *buf = strdup(launchers[i].command);
+                if (!buf || !launchParse(buf, launcherArgv[i])) {
+                        free(buf);
+                        launcherArgv[i][0] = NULL;
+                }
+        }
+        // another WM already holds SubstructureRedirect on the root
+        xcb_generic_error_t *err = xcb_request_check(conn, redirect);
+        if (err) {
+                free(err);
+                die();
+        }
+        for (unsigned char i = 0; i < AtomLast; i++) {
+                xcb_intern_atom_reply_t *r = xcb_intern_atom_reply(conn, atomCookies[i], NULL);
+                if (!r) die();
+                atoms[i] = r->atom;
+                free(r);
+        }
+        grabKeys(keymapCookie);
+        xcb_flush(conn);
+}
+static xcb_get_keyboard_mapping_cookie_t requestKeymap(void) {
+        const xcb_setup_t *xsetup = xcb_get_setup(conn);
+        return xcb_get_keyboard_mapping(conn, xsetup->min_keycode,
+                                        xsetup->max_keycode - xsetup->min_keycode + 1);
+}
+static void grabKey(unsigned char code, unsigned int modifiers) {
+        xcb_grab_key(conn, 1, root, modifiers, code, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+}
+// Fills keyTable and the grabs from one keyboard mapping reply.
+static void grabKeys(xcb_get_keyboard_mapping_cookie_t cookie) {
+        xcb_get_keyboard_mapping_reply_t *keymap =
+            xcb_get_keyboard_mapping_reply(conn, cookie, NULL);
+        if (!keymap) return;
+        const xcb_keysym_t *syms = xcb_get_keyboard_mapping_keysyms(keymap);
+        int len                  = xcb_get_keyboard_mapping_keysyms_length(keymap);
+        unsigned int perCode     = keymap->keysyms_per_keycode;
+        xcb_keycode_t min        = xcb_get_setup(conn)->min_keycode;
+        memset(keyTable, 0, sizeof(keyTable));
+        xcb_ungrab_key(conn, XCB_GRAB_ANY, root, XCB_MOD_MASK_ANY);
+        for (int i = 0; perCode && i < len; i += perCode)
+                keyBind(min + i / perCode, syms[i], grabKey);
+        free(keymap);
+}
+// Everything a batch of events left dirty, applied once the queue is drained.
+static void finishBatch(void) {
+        if (keysDirty) {
+                grabKeys(requestKeymap());
+                keysDirty  = 0;
+                need_flush = 1;
+        }
+        if (layoutDirty) {
+                tileWindows();
+                layoutDirty = 0;
+                need_flush  = 1;
+        }
+        if (need_flush) {
+                xcb_flush(conn);
+                need_flush = 0;
+        }
+        collectProtocols();
+}
+static void handleEvent(xcb_generic_event_t *e) {
+        switch (e->response_type & ~0x80) {
+                case XCB_KEY_PRESS:
+                        handleKeyPress((xcb_key_press_event_t *)e);
+                        break;
+                case XCB_MAP_REQUEST:
+                        handleMapRequest(((xcb_map_request_event_t *)e)->window);
+                        break;
+                case XCB_UNMAP_NOTIFY:
+                        handleUnmapNotify(((xcb_unmap_notify_event_t *)e)->window);
+                        break;
+                case XCB_DESTROY_NOTIFY:
+                        handleDestroyNotify(((xcb_destroy_notify_event_t *)e)->window);
+                        break;
+                case XCB_PROPERTY_NOTIFY:
+                        handlePropertyNotify((xcb_property_notify_event_t *)e);
+                        break;
+                case XCB_MAPPING_NOTIFY: {
+                        xcb_mapping_notify_event_t *ev = (xcb_mapping_notify_event_t *)e;
+                        if (ev->request == XCB_MAPPING_KEYBOARD ||
+                            ev->request == XCB_MAPPING_MODIFIER)
+                                keysDirty = 1;
+                        break;
+                }
+                case XCB_CONFIGURE_NOTIFY: {
+                        xcb_configure_notify_event_t *ev = (xcb_configure_notify_event_t *)e;
+                        if (ev->window != root) break;
+                        screen_width          = ev->width;
+                        screen_height         = ev->height;
+                        const uint32_t size[] = {screen_width, screen_height};
+                        for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
+                                xcb_configure_window(conn, desktops[d].container,
+                                                     XCB_CONFIG_WINDOW_WIDTH |
+                                                         XCB_CONFIG_WINDOW_HEIGHT,
+                                                     size);
+                        }
+                        layoutDirty = 1;
+                        break;
+                }
+                default:
+                        // response_type 0 is an error, mostly from windows that are
+                        // already gone; ignored
+                        break;
+        }
+}
+static void run(void) {
+        xcb_generic_event_t *e;
+        fd_set fds;
+        int xfd = xcb_get_file_descriptor(conn);
+        while (running) {
+                while ((e = xcb_poll_for_event(conn))) {
+                        handleEvent(e);
+                        free(e);
+                }
+                if (xcb_connection_has_error(conn)) break;
+                finishBatch();
+                // the replies finishBatch() waited for can bring events along;
+                // they are queued inside xcb, where select() would not see them
+                if ((e = xcb_poll_for_queued_event(conn))) {
+                        handleEvent(e);
+                        free(e);
+                        continue;
+                }
+                FD_ZERO(&fds);
+                FD_SET(xfd, &fds);
+                if (select(xfd + 1, &fds, NULL, NULL, NULL) == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        else
+                                break;
+                }
+        }
+}
+static void killFocusedWindow(void) {
+        if (CURRENT_DESKTOP.windowCount == 0) return;
+        Client *c = CURRENT_DESKTOP.clients[CURRENT_DESKTOP.focusedIdx];
+        if (c->protocols & PROTO_DELETE) {
+                xcb_client_message_event_t ev = {0};
+                ev.response_type              = XCB_CLIENT_MESSAGE;
+                ev.window                     = c->win;
+                ev.type                       = atoms[WMProtocols];
+                ev.format                     = 32;
+                ev.data.data32[0]             = atoms[WMDelete];
+                ev.data.data32[1]             = XCB_CURRENT_TIME;
+                xcb_send_event(conn, 0, c->win, XCB_EVENT_MASK_NO_EVENT, (const char *)&ev);
+        } else {
+                xcb_kill_client(conn, c->win);
+        }
+        need_flush = 1;
+}
+static void collectProtocols(void) {
+        for (unsigned char p = 0; p < pendingCount; p++) {
+                xcb_get_property_reply_t *r =
+                    xcb_get_property_reply(conn, pending[p].cookie, NULL);
+                if (!r) continue;
+                unsigned char flags    = 0;
+                const xcb_atom_t *list = xcb_get_property_value(r);
+                int count              = xcb_get_property_value_length(r) / sizeof(xcb_atom_t);
+                for (int i = 0; i < count; i++) {
+                        if (list[i] == atoms[WMDelete]) flags |= PROTO_DELETE;
+                }
+                free(r);
+                // the window may have gone while the reply was on its way
+                Client *c = clientLookup(pending[p].win);
+                if (c) c->protocols = flags;
+        }
+        pendingCount = 0;
+}
+static void requestProtocols(xcb_window_t win) {
+        if (pendingCount == MAX_PENDING_REPLIES) collectProtocols();
+        pending[pendingCount].win    = win;
+        pending[pendingCount].cookie = xcb_get_property(conn, 0, win, atoms[WMProtocols],
+                                                        XCB_ATOM_ATOM, 0, 32);
+        pendingCount++;
+}
+static void handlePropertyNotify(xcb_property_notify_event_t *ev) {
+        if (ev->atom != atoms[WMProtocols] || !clientLookup(ev->window)) return;
+        requestProtocols(ev->window);
+}
+inline static void focusCycleWindow(_Bool forward) {
+        if (CURRENT_DESKTOP.windowCount <= 1) return;
+        int idx = CURRENT_DESKTOP.focusedIdx + (forward ? 1 : -1);
+        idx += CURRENT_DESKTOP.windowCount * (idx < 0);
+        idx -= CURRENT_DESKTOP.windowCount * (idx >= CURRENT_DESKTOP.windowCount);
+        CURRENT_DESKTOP.focusedIdx = idx;
+        focusWindow(CURRENT_DESKTOP.clients[idx]->win);
+        // tiled windows never overlap; stacked ones need the focused one raised
+        if (CURRENT_DESKTOP.layout == LayoutMonocle) layoutDirty = 1;
+}
+static void resizeMaster(int delta) {
+        int limit = screen_width / 2 - 100;
+        int rd    = resizeDelta[currentDesktop] + delta;
+        if (rd < -limit) rd = -limit;
+        if (rd > limit) rd = limit;
+        resizeDelta[currentDesktop] = rd;
+        layoutDirty                 = 1;
+}
+static void handleKeyPress(xcb_key_press_event_t *ev) {
+        if (ev->state != MOD_KEY && ev->state != (MOD_KEY | ShiftMask)) return;
+        KeyAction a = keyTable[ev->detail][(ev->state & ShiftMask) != 0];
+        switch (a.action) {
+                case ActQuit:
+                        running = 0;
+                        break;
+                case ActKill:
+                        killFocusedWindow();
+                        break;
+                case ActFocus:
+                        focusCycleWindow(a.arg);
+                        break;
+                case ActResize:
+                        resizeMaster(a.arg ? RESIZE_STEP : -RESIZE_STEP);
+                        break;
+                case ActLayout:
+                        CURRENT_DESKTOP.layout = (CURRENT_DESKTOP.layout + 1) % LayoutLast;
+                        layoutDirty            = 1;
+                        break;
+                case ActDesktop:
+                        switchDesktop(a.arg);
+                        break;
+                case ActMove:
+                        if (CURRENT_DESKTOP.windowCount == 0) break;
+                        moveWindowToDesktop(
+                            CURRENT_DESKTOP.clients[CURRENT_DESKTOP.focusedIdx]->win, a.arg);
+                        break;
+                case ActLaunch:
+                        launchSpawn(launcherArgv[a.arg], launchers[a.arg].command);
+                        break;
+                default:
+                        break;
+        }
+}
+static Client *clientLookup(xcb_window_t win) { return indexLookup(&windowIndex, win); }
+static void attachClient(Client *c, unsigned char desktop) {
+        Desktop *d = &desktops[desktop];
+        if (d->windowCount == d->capacity) {
+                // slots and counts are unsigned short: a desktop that is full at
+                // USHRT_MAX is treated like running out of memory
+                if (d->capacity == USHRT_MAX) die();
+                unsigned int capacity = d->capacity * 2u;
+                if (capacity > USHRT_MAX) capacity = USHRT_MAX;
+                Client **grown = realloc(d->clients, capacity * sizeof(Client *));
+                if (!grown) die();
+                d->clients  = grown;
+                d->capacity = capacity;
+        }
+        c->desktop                 = desktop;
+        c->slot                    = d->windowCount;
+        d->clients[d->windowCount] = c;
+        d->windowCount++;
+        // reparenting stacks c above every window already in the container
+        xcb_reparent_window(conn, c->win, d->container, c->x, c->y);
+        for (unsigned short i = 0; i < c->slot; i++) d->clients[i]->onTop = 0;
+        c->onTop = 1;
+}
+static void detachClient(Client *c) {
+        Desktop *d          = &desktops[c->desktop];
+        unsigned short slot = c->slot;
+        d->windowCount--;
+        memmove(&d->clients[slot], &d->clients[slot + 1],
+                (d->windowCount - slot) * sizeof(Client *));
+        for (unsigned short i = slot; i < d->windowCount; i++) d->clients[i]->slot = i;
+        if (d->windowCount == 0) {
+                d->focusedIdx = 0;
+                return;
+        }
+        if (slot < d->focusedIdx) d->focusedIdx--;
+        if (d->focusedIdx >= d->windowCount) d->focusedIdx = d->windowCount - 1;
+        if (d == &CURRENT_DESKTOP) focusWindow(d->clients[d->focusedIdx]->win);
+}
+static Client *manageClient(xcb_window_t win, unsigned char desktop) {
+        if (!freeClients) {
+                Client *chunk = calloc(POOL_CHUNK, sizeof(Client));
+                if (!chunk) die();
+                for (unsigned int i = 0; i < POOL_CHUNK; i++) {
+                        chunk[i].next = freeClients;
+                        freeClients   = &chunk[i];
+                }
+        }
+        Client *c       = freeClients;
+        freeClients     = c->next;
+        c->win          = win;
+        c->ignoreUnmaps = 0;
+        c->protocols    = 0;
+        c->x = c->y = 0;
+        c->w        = 0;
+        if (!indexInsert(&windowIndex, c->win, c)) die();
+        attachClient(c, desktop);
+        return c;
+}
+static void unmanageClient(Client *c) {
+        detachClient(c);
+        indexRemove(&windowIndex, c->win);
+        c->next     = freeClients;
+        freeClients = c;
+}
+static void moveWindowToDesktop(xcb_window_t win, unsigned char desktop) {
+        if (desktop >= MAX_DESKTOPS || desktop == currentDesktop) return;
+        Client *c = clientLookup(win);
+        if (!c || c->desktop != currentDesktop) return;
+        detachClient(c);
+        // the server unmaps c before reparenting it and maps it again after;
+        // the hidden container keeps it invisible
+        c->ignoreUnmaps++;
+        attachClient(c, desktop);
+        layoutDirty = 1;
+}
+inline static void focusWindow(xcb_window_t w) {
+        if (w == XCB_NONE) return;
+        xcb_set_input_focus(conn, XCB_INPUT_FOCUS_PARENT, w, XCB_CURRENT_TIME);
+}
+static void handleDestroyNotify(xcb_window_t win) {
+        Client *c = clientLookup(win);
+        if (!c) return;
+        unsigned char desktop = c->desktop;
+        unmanageClient(c);
+        if (desktop == currentDesktop) layoutDirty = 1;
+}
+static void cleanup(void) {
+        for (unsigned char d = 0; d < MAX_DESKTOPS; d++) {
+                for (unsigned short i = 0; i < desktops[d].windowCount; i++) {
+                        Client *c = desktops[d].clients[i];
+                        xcb_unmap_window(conn, c->win);
+                        xcb_reparent_window(conn, c->win, root, c->x, c->y);
+                }
+        }
+        // the containers go with the connection
+        xcb_disconnect(conn);
+}
+// Sends only what differs from the last geometry and stacking sent.
+static void configureClient(Client *c, int x, int y, unsigned int w, unsigned int h,
+                            _Bool raise) {
+        uint32_t values[5];
+        uint16_t mask   = 0;
+        unsigned char n = 0;
+        if (c->w != w || c->h != h || c->x != x || c->y != y) {
+                values[n++] = (uint32_t)(c->x = x);
+                values[n++] = (uint32_t)(c->y = y);
+                values[n++] = c->w = w;
+                values[n++] = c->h = h;
+                mask        = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                              XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+        }
+        if (raise && !c->onTop) {
+                values[n++] = XCB_STACK_MODE_ABOVE;
+                mask |= XCB_CONFIG_WINDOW_STACK_MODE;
+                for (unsigned short i = 0; i < CURRENT_DESKTOP.windowCount; i++)
+                        CURRENT_DESKTOP.clients[i]->onTop = 0;
+                c->onTop = 1;
+        }
+        if (mask) xcb_configure_window(conn, c->win, mask, values);
+}
+static void tileWindows(void) {
+        const unsigned short n = CURRENT_DESKTOP.windowCount;
+        if (n == 0) return;
+        if (n > layoutBufLen) {
+                Geometry *grown = realloc(layoutBuf, CURRENT_DESKTOP.capacity * sizeof(Geometry));
+                if (!grown) die();
+                layoutBuf    = grown;
+                layoutBufLen = CURRENT_DESKTOP.capacity;
+        }
+        layoutApply(CURRENT_DESKTOP.layout, n, screen_width, screen_height,
+                    resizeDelta[currentDesktop], layoutBuf);
+        const unsigned short focused = CURRENT_DESKTOP.focusedIdx;
+        for (unsigned short i = 0; i < n; i++) {
+                Geometry *g = &layoutBuf[i];
+                // a lone window is raised even if focus is elsewhere
+                configureClient(CURRENT_DESKTOP.clients[i], g->x, g->y, g->w, g->h,
+                                focused == i || n == 1);
+        }
+}
+static void handleMapRequest(xcb_window_t win) {
+        Client *c = clientLookup(win);
+        if (c) {
+                // a window remapping itself while its desktop is hidden joins the
+                // current one
+                if (c->desktop != currentDesktop) {
+                        detachClient(c);
+                        attachClient(c, currentDesktop);
+                }
+        } else {
+                c                   = manageClient(win, currentDesktop);
+                const uint32_t mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+                xcb_change_save_set(conn, XCB_SET_MODE_INSERT, win);
+                xcb_change_window_attributes(conn, win, XCB_CW_EVENT_MASK, &mask);
+                requestProtocols(win);
+        }
+        CURRENT_DESKTOP.focusedIdx = c->slot;
+        xcb_map_window(conn, win);
+        focusWindow(win);
+        layoutDirty = 1;
+}
+static void switchDesktop(unsigned char newDesk) {
+        if (newDesk == currentDesktop || newDesk >= MAX_DESKTOPS) return;
+        // stack the new container directly above the old one before mapping it,
+        // so the root never shows through and override-redirect windows above
+        // both stay there
+        const uint32_t above[] = {CURRENT_DESKTOP.container, XCB_STACK_MODE_ABOVE};
+        xcb_configure_window(conn, desktops[newDesk].container,
+                             XCB_CONFIG_WINDOW_SIBLING | XCB_CONFIG_WINDOW_STACK_MODE, above);
+        xcb_map_window(conn, desktops[newDesk].container);
+        xcb_unmap_window(conn, CURRENT_DESKTOP.container);
+        currentDesktop = newDesk;
+        layoutDirty    = 1;
+        if (CURRENT_DESKTOP.windowCount > 0)
+                focusWindow(CURRENT_DESKTOP.clients[CURRENT_DESKTOP.focusedIdx]->win);
+}
+static void handleUnmapNotify(xcb_window_t win) {
+        Client *c = clientLookup(win);
+        if (!c) return;
+        if (c->ignoreUnmaps) {
+                c->ignoreUnmaps--;
+                return;
+        }
+        unsigned char desktop = c->desktop;
+        unmanageClient(c);
+        if (desktop == currentDesktop) layoutDirty = 1;
+        // withdrawn: hand the window back to the root so that the save-set
+        // does not map it again when mwm exits. xcb cannot look ahead for a
+        // DestroyNotify without dequeuing it; errors from a client that
+        // already exited are ignored in handleEvent()
+        xcb_reparent_window(conn, win, root, 0, 0);
+        xcb_change_save_set(conn, XCB_SET_MODE_DELETE, win);
+}
@@ -0,0 +1,123 @@
+// Hot-path instrumentation, built only into `make mwm-stats` (-DMWM_STATS).
+// Without MWM_STATS every macro below expands to nothing, so the default mwm
+// binary carries no code or data for it. Needs <X11/Xlib.h> and _GNU_SOURCE.
+#ifdef MWM_STATS
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+// latency buckets: bucket i counts spans of [2^i, 2^(i+1)) ns, the last one
+// everything from ~1s up
+#define STATS_BUCKETS 31
+enum {
+        StatsKeyPress,
+        StatsMapRequest,
+        StatsUnmapNotify,
+        StatsDestroyNotify,
+        StatsTileWindows,
+        StatsSwitchDesktop,
+        StatsLast
+};
+static const char *const statsHandlerNames[StatsLast] = {
+    "keypress", "maprequest", "unmapnotify", "destroynotify", "tile", "switch"};
+static const char *const statsEventNames[LASTEvent] = {
+    [KeyPress] = "KeyPress",           [KeyRelease] = "KeyRelease",
+    [ButtonPress] = "ButtonPress",     [ButtonRelease] = "ButtonRelease",
+    [MotionNotify] = "MotionNotify",   [EnterNotify] = "EnterNotify",
+    [LeaveNotify] = "LeaveNotify",     [FocusIn] = "FocusIn",
+    [FocusOut] = "FocusOut",           [KeymapNotify] = "KeymapNotify",
+    [Expose] = "Expose",               [GraphicsExpose] = "GraphicsExpose",
+    [NoExpose] = "NoExpose",           [VisibilityNotify] = "VisibilityNotify",
+    [CreateNotify] = "CreateNotify",   [DestroyNotify] = "DestroyNotify",
+    [UnmapNotify] = "UnmapNotify",     [MapNotify] = "MapNotify",
+    [MapRequest] = "MapRequest",       [ReparentNotify] = "ReparentNotify",
+    [ConfigureNotify] = "ConfigureNotify", [ConfigureRequest] = "ConfigureRequest",
+    [GravityNotify] = "GravityNotify", [ResizeRequest] = "ResizeRequest",
+    [CirculateNotify] = "CirculateNotify", [CirculateRequest] = "CirculateRequest",
+    [PropertyNotify] = "PropertyNotify", [SelectionClear] = "SelectionClear",
+    [SelectionRequest] = "SelectionRequest", [SelectionNotify] = "SelectionNotify",
+    [ColormapNotify] = "ColormapNotify", [ClientMessage] = "ClientMessage",
+    [MappingNotify] = "MappingNotify", [GenericEvent] = "GenericEvent"};
+typedef struct {
+        unsigned long calls;
+        unsigned long requests;// X requests queued while the handler ran
+        unsigned long long ns;
+        unsigned long hist[STATS_BUCKETS];
+} StatsHandler;
+static struct {
+        unsigned long events[LASTEvent + 1];// last slot: extension events
+        unsigned long roundTrips;
+        unsigned long flushes;
+        StatsHandler handlers[StatsLast];
+        int fd;
+} stats;
+// One span per handler invocation; closed by the cleanup attribute when the
+// handler returns, so early returns are measured too.
+typedef struct {
+        Display *dpy;
+        unsigned char handler;
+        unsigned long serial;
+        unsigned long long start;
+} StatsSpan;
+static inline unsigned long long statsNowNs(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+static inline StatsSpan statsBegin(Display *dpy, unsigned char handler) {
+        return (StatsSpan){dpy, handler, NextRequest(dpy), statsNowNs()};
+}
+static inline void statsEnd(StatsSpan *s) {
+        unsigned long long ns = statsNowNs() - s->start;
+        StatsHandler *h       = &stats.handlers[s->handler];
+        unsigned int bucket   = ns ? 63 - __builtin_clzll(ns) : 0;
+        h->calls++;
+        h->requests += NextRequest(s->dpy) - s->serial;
+        h->ns += ns;
+        h->hist[bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1]++;
+}
+// Dumps go to stderr, or to the descriptor named by MWM_STATS_FD, e.g.
+// `MWM_STATS_FD=3 mwm 3>>/tmp/mwm.stats`.
+static void statsInit(void) {
+        const char *fd = getenv("MWM_STATS_FD");
+        stats.fd       = fd ? atoi(fd) : 2;
+}
+static void statsDump(void) {
+        char buf[4096];
+        int len = snprintf(buf, sizeof(buf), "mwm:stats roundtrips %lu flushes %lu\nmwm:events",
+                           stats.roundTrips, stats.flushes);
+        for (int i = 0; i <= LASTEvent && len < (int)sizeof(buf); i++) {
+                if (!stats.events[i]) continue;
+                const char *name = "other";
+                if (i < LASTEvent && statsEventNames[i]) name = statsEventNames[i];
+                len += snprintf(buf + len, sizeof(buf) - len, " %s %lu", name, stats.events[i]);
+        }
+        for (int i = 0; i < StatsLast && len < (int)sizeof(buf); i++) {
+                StatsHandler *h = &stats.handlers[i];
+                if (!h->calls) continue;
+                len += snprintf(buf + len, sizeof(buf) - len,
+                                "\nmwm:%s calls %lu requests %lu avg %lluns log2ns",
+                                statsHandlerNames[i], h->calls, h->requests, h->ns / h->calls);
+                for (int b = 0; b < STATS_BUCKETS && len < (int)sizeof(buf); b++) {
+                        if (!h->hist[b]) continue;
+                        len += snprintf(buf + len, sizeof(buf) - len, " %d:%lu", b, h->hist[b]);
+                }
+        }
+        if (len < (int)sizeof(buf)) len += snprintf(buf + len, sizeof(buf) - len, "\n");
+        if (len > (int)sizeof(buf)) len = sizeof(buf);
+        __attribute__((unused)) ssize_t _ = write(stats.fd, buf, len);
+}
+#define STATS_INIT() statsInit()
+#define STATS_DUMP() statsDump()
+#define STATS_EVENT(type) stats.events[(type) < LASTEvent ? (type) : LASTEvent]++
+#define STATS_ROUNDTRIP() stats.roundTrips++
+#define STATS_FLUSH() stats.flushes++
+#define STATS_SPAN(handler)                                                                      \
+        __attribute__((cleanup(statsEnd))) StatsSpan statsSpan = statsBegin(dpy, handler)
+#else
+#define STATS_INIT() ((void)0)
+#define STATS_DUMP() ((void)0)
+#define STATS_EVENT(type) ((void)0)
+#define STATS_ROUNDTRIP() ((void)0)
+#define STATS_FLUSH() ((void)0)
+#define STATS_SPAN(handler) ((void)0)
+#endif
@@ -0,0 +1,147 @@
+// Event traces: `make mwm-trace` (-DMWM_TRACE) writes every event mwm acts on
+// to $MWM_TRACE_FILE (/tmp/mwm.trace by default), and bench/replay feeds such a
+// trace back through the handlers without an X server. The record format is
+// always defined; the recorder only with MWM_TRACE. Needs <X11/Xlib.h>.
+#include <stdint.h>
+#define TRACE_MAGIC "mwT"
+#define TRACE_VERSION 2
+// header flags: media keys went to the audio helper
+#define TRACE_HELPER (1 << 0)
+// A header, then one TraceRecord per event and a TraceBatchEnd wherever mwm
+// drained its queue and ran the deferred relayout. Times are milliseconds
+// since the header was written.
+typedef struct {
+        char magic[3];
+        uint8_t version;
+        uint16_t width, height;// screen size at startup
+        uint32_t flags;
+        uint32_t keymap[256];// unshifted keysym of each keycode at startup
+} TraceHeader;
+enum {
+        TraceKeyPress,      // a keycode, b state
+        TraceMapRequest,    // window
+        TraceUnmapNotify,   // window
+        TraceDestroyNotify, // window
+        TracePropertyNotify,// window, a 0 for WM_PROTOCOLS, 1 the sync counter, 2 _NET_WM_STATE
+        TraceMappingNotify, // a request
+        TraceRootResize,    // b width, window height
+        TraceBatchEnd,      // window time
+        TraceTimer,         // a timer, window time
+        TraceSyncAlarm,     // window whose sync counter reached the requested value
+        TraceProtocols,     // window, a PROTO_ flags read from its WM_PROTOCOLS
+        TraceKeysym,        // a keycode, window its new unshifted keysym
+        TraceControl,       // a length, b 1 if too long; the control socket line follows
+        TraceAudio,         // a length, then the helper's reply; b 1 if it went away instead
+        TraceLast
+};
+typedef struct {
+        uint8_t kind;
+        uint8_t a;
+        uint16_t b;
+        uint32_t window;// XIDs are 29 bits
+} TraceRecord;
+// TraceControl and TraceAudio are followed by their text, padded to whole records.
+#define TRACE_PAYLOAD(len) (((len) + sizeof(TraceRecord) - 1) / sizeof(TraceRecord))
+#ifdef MWM_TRACE
+#include <stdio.h>
+#include <stdlib.h>
+static struct {
+        FILE *file;
+        _Bool pending;// records written since the last TraceBatchEnd
+        unsigned long long start;
+        uint32_t keymap[256];// as last read, so that only changes are written
+} trace;
+// Called once setup() is done, so the header has the keymap it read. A
+// restarted mwm starts a new trace: replay cannot rebuild handed-over state.
+static void traceInit(unsigned int width, unsigned int height, _Bool helper,
+                      unsigned long long now) {
+        const char *path = getenv("MWM_TRACE_FILE");
+        trace.file       = fopen(path ? path : "/tmp/mwm.trace", "we");
+        if (!trace.file) return;
+        TraceHeader h = {TRACE_MAGIC, TRACE_VERSION, width, height, helper ? TRACE_HELPER : 0, {0}};
+        memcpy(h.keymap, trace.keymap, sizeof(h.keymap));
+        fwrite(&h, sizeof(h), 1, trace.file);
+        trace.start = now;
+}
+static void traceWrite(uint8_t kind, uint8_t a, uint16_t b, uint32_t window) {
+        if (!trace.file) return;
+        TraceRecord r = {kind, a, b, window};
+        fwrite(&r, sizeof(r), 1, trace.file);
+        trace.pending = 1;
+}
+static void traceText(uint8_t kind, const char *text, uint8_t len, uint16_t b) {
+        if (!trace.file) return;
+        TraceRecord pad[TRACE_PAYLOAD(255)] = {0};
+        traceWrite(kind, len, b, 0);
+        memcpy(pad, text, len);
+        fwrite(pad, sizeof(TraceRecord), TRACE_PAYLOAD(len), trace.file);
+}
+// Only events some handler acts on are kept.
+static void traceEvent(const XEvent *e, Window root, const Atom *props) {
+        switch (e->type) {
+                case KeyPress:
+                        traceWrite(TraceKeyPress, e->xkey.keycode, e->xkey.state, 0);
+                        break;
+                case MapRequest:
+                        traceWrite(TraceMapRequest, 0, 0, e->xmaprequest.window);
+                        break;
+                case UnmapNotify:
+                        traceWrite(TraceUnmapNotify, 0, 0, e->xunmap.window);
+                        break;
+                case DestroyNotify:
+                        traceWrite(TraceDestroyNotify, 0, 0, e->xdestroywindow.window);
+                        break;
+                case PropertyNotify:
+                        for (uint8_t i = 0; i < 3; i++) {
+                                if (e->xproperty.atom == props[i])
+                                        traceWrite(TracePropertyNotify, i, 0, e->xproperty.window);
+                        }
+                        break;
+                case MappingNotify:
+                        traceWrite(TraceMappingNotify, e->xmapping.request, 0, 0);
+                        break;
+                case ConfigureNotify:
+                        if (e->xconfigure.window == root)
+                                traceWrite(TraceRootResize, 0, e->xconfigure.width,
+                                           e->xconfigure.height);
+                        break;
+        }
+}
+// Called for every keycode each time mwm reads the keyboard mapping; before
+// the header is written this only fills in the keymap it carries.
+static void traceKeysym(uint8_t code, unsigned long sym) {
+        if (trace.keymap[code] == sym) return;
+        trace.keymap[code] = sym;
+        traceWrite(TraceKeysym, code, 0, sym);
+}
+// Flushed per batch, so a trace survives mwm dying in _exit().
+static void traceBatch(unsigned long long now) {
+        if (!trace.pending) return;
+        traceWrite(TraceBatchEnd, 0, 0, now - trace.start);
+        fflush(trace.file);
+        trace.pending = 0;
+}
+#define TRACE_INIT(width, height, helper) traceInit(width, height, helper, nowMs())
+#define TRACE_EVENT(e)                                                                           \
+        traceEvent(e, root, (Atom[]){atoms[WMProtocols], atoms[NetWMSyncRequestCounter],        \
+                                     atoms[NetWMState]})
+#define TRACE_BATCH() traceBatch(nowMs())
+#define TRACE_TIMER(timer) traceWrite(TraceTimer, timer, 0, nowMs() - trace.start)
+#define TRACE_ALARM(win) traceWrite(TraceSyncAlarm, 0, 0, win)
+#define TRACE_PROTOCOLS(win, flags) traceWrite(TraceProtocols, flags, 0, win)
+#define TRACE_KEYSYM(code, sym) traceKeysym(code, sym)
+#define TRACE_CONTROL(line, len, overlong) traceText(TraceControl, line, len, overlong)
+#define TRACE_AUDIO(reply, len) traceText(TraceAudio, reply, len, 0)
+#define TRACE_AUDIO_GONE() traceWrite(TraceAudio, 0, 1, 0)
+#else
+#define TRACE_INIT(width, height, helper) ((void)0)
+#define TRACE_EVENT(e) ((void)0)
+#define TRACE_BATCH() ((void)0)
+#define TRACE_TIMER(timer) ((void)0)
+#define TRACE_ALARM(win) ((void)0)
+#define TRACE_PROTOCOLS(win, flags) ((void)0)
+#define TRACE_KEYSYM(code, sym) ((void)0)
+#define TRACE_CONTROL(line, len, overlong) ((void)0)
+#define TRACE_AUDIO(reply, len) ((void)0)
+#define TRACE_AUDIO_GONE() ((void)0)
+#endif